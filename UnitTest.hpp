@@ -16,11 +16,48 @@
 #include <exception>
 #include <iostream>
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <atomic>
+#include <map>
+#include <fstream>
+#include <random>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 #ifdef _WIN32
 #include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #endif // _WIN32
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define AP_HAS_TSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
+#endif // x86
+
 class APFailException : public std::exception
 {
 };
@@ -66,174 +103,4568 @@ public:
 	}
 };
 
-class UnitTestsManager
+enum class Complexity
 {
-	struct TestExec
+	UNSPECIFIED,
+	CONSTANT,
+	LOGARITHMIC,
+	LINEAR,
+	LINEARITHMIC,
+	QUADRATIC
+};
+
+template <typename T>
+inline void DoNotOptimize(const T& value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	asm volatile("" : : "r,m"(value) : "memory");
+#else
+	const volatile char* volatile sink = reinterpret_cast<const volatile char*>(&value);
+	(void)sink;
+#endif
+}
+
+struct BenchmarkOptions
+{
+	std::vector<int64_t> args;
+	Complexity expectedComplexity = Complexity::UNSPECIFIED;
+	std::vector<int> threadCounts;
+	std::chrono::nanoseconds minTime = std::chrono::milliseconds(100);
+	bool coldCache = false;
+	uint64_t coldRepetitions = 0;
+	uint64_t coldBatchSize = 0;
+	int comparisonBlocks = 30;
+
+	// Run the benchmark once per argument from start to limit (included), multiplying by multiplier at each step.
+	// The steps after a start below 1 begin at 1, an inverted range is swapped
+	BenchmarkOptions& Range(int64_t start, int64_t limit, int64_t multiplier = 8)
 	{
-		std::vector<std::string> errorMsgs;
-	};
-	
-	std::vector<UnitTest> m_registeredUnitTests;
-	TestExec m_currentTest;
+		args.clear();
 
-	enum class TestResult
+		if (start > limit)
+			std::swap(start, limit);
+
+		const int64_t factor = (std::max)(multiplier, static_cast<int64_t>(2));
+		int64_t arg = start;
+		args.push_back(start);
+
+		if (arg < 1)
+		{
+			arg = 1;
+
+			if (arg < limit)
+				args.push_back(arg);
+		}
+
+		while (arg <= limit / factor)	// arg * factor <= limit, without overflowing
+		{
+			arg *= factor;
+
+			if (arg < limit)
+				args.push_back(arg);
+		}
+
+		if (limit > start)
+			args.push_back(limit);
+
+		return *this;
+	}
+
+	// The benchmark fails if the complexity fitted from the range is worse than this one
+	BenchmarkOptions& ExpectComplexity(Complexity complexity)
 	{
-		DEFAULT,
-		SUCCESS,
-		FAILURE
-	};
-	
-public:
-	UnitTestsManager() = default;
-	UnitTestsManager(UnitTestsManager const&) = delete;
-	void operator=(UnitTestsManager const&) = delete;
+		expectedComplexity = complexity;
+		return *this;
+	}
 
-	void RunTests(std::ostream& output, const std::string& testsPath = "")
+	// Run the body on 1, 2, 4... up to maxThreads threads (included), all released together when they first call KeepRunning
+	BenchmarkOptions& Threads(int maxThreads)
 	{
-		const bool isConsole = (output.rdbuf() == std::cout.rdbuf());
+		threadCounts.clear();
 
-		const auto toExecuteTestsCount = static_cast<int>(m_registeredUnitTests.size());
-		int successCount = 0;
-		int errorsCount = 0;
+		for (int threads = 1; threads < maxThreads; threads *= 2)
+		{
+			threadCounts.push_back(threads);
+		}
 
-		SortTests();
+		threadCounts.push_back((std::max)(maxThreads, 1));
+		return *this;
+	}
 
-		output << "EXECUTING " << toExecuteTestsCount << " UNIT TESTS..." << '\n';
-		
-		for (const UnitTest& test : m_registeredUnitTests)
-		{
-			std::string exceptionError;
-			m_currentTest = TestExec();
+	// Also run the benchmark with the CPU caches evicted before every batch of batchSize iterations, reported next to the warm result
+	BenchmarkOptions& ColdCache(uint64_t repetitions = 100, uint64_t batchSize = 1)
+	{
+		coldCache = true;
+		coldRepetitions = (std::max)(repetitions, static_cast<uint64_t>(1));
+		coldBatchSize = (std::max)(batchSize, static_cast<uint64_t>(1));
+		return *this;
+	}
 
-			const bool testResult = test.Run(exceptionError);
+	// Number of randomized AB or BA blocks of a BENCHMARK_COMPARE, each repetition lasting about a tenth of the minimal time
+	BenchmarkOptions& ComparisonBlocks(int blocks)
+	{
+		comparisonBlocks = (std::max)(blocks, 2);
+		return *this;
+	}
+
+	BenchmarkOptions& MinTime(std::chrono::nanoseconds time)
+	{
+		minTime = time;
+		return *this;
+	}
+};
+
+class SpinBarrier
+{
+	std::atomic<int> m_waiting;
+	std::atomic<int> m_generation;
+	const int m_count;
+
+public:
+	explicit SpinBarrier(int count)
+		: m_waiting(0)
+		, m_generation(0)
+		, m_count(count)
+	{
+	}
+
+	void Wait()
+	{
+		const int generation = m_generation.load(std::memory_order_acquire);
+
+		if (m_waiting.fetch_add(1, std::memory_order_acq_rel) + 1 == m_count)
+		{
+			m_waiting.store(0, std::memory_order_relaxed);
+			m_generation.fetch_add(1, std::memory_order_release);
+			return;
+		}
 
-			if (testResult && m_currentTest.errorMsgs.empty())
+		for (unsigned int spins = 1; m_generation.load(std::memory_order_acquire) == generation; ++spins)
+		{
+			if (spins % 1024 == 0)
 			{
-				Write(output, "TEST " + test.GetFullName() + " -> SUCCESS", isConsole, TestResult::SUCCESS);
-				++successCount;
+				std::this_thread::yield();	// Do not starve the other threads when there are more threads than cores
 			}
-			else
-			{
-				Write(output, "TEST " + test.GetFullName() + " -> FAILURE", isConsole, TestResult::FAILURE);
+		}
+	}
+};
 
-				for (const std::string& errorMsg : m_currentTest.errorMsgs)
-				{
-					Write(output, "\t " + errorMsg, isConsole, TestResult::FAILURE);
-				}
+// Benchmark timing source: the TSC when it is invariant (constant rate and not stopped in deep C-states), std::chrono::steady_clock otherwise
+class BenchmarkClock
+{
+	bool m_useTsc = false;
+	double m_nsPerTick = 1.0;
+	double m_overheadNs = 0.0;
 
-				if (!exceptionError.empty())
-				{
-					Write(output, "\t Exception triggered: " + exceptionError, isConsole, TestResult::FAILURE);
-				}
-				
-				++errorsCount;
-			}
+	BenchmarkClock()
+	{
+		m_useTsc = HasInvariantTsc();
+
+		if (m_useTsc)
+		{
+			Calibrate();
 		}
 
-		const TestResult finalResult = (errorsCount == 0) ? TestResult::SUCCESS : TestResult::FAILURE;
-		Write(output, "EXECUTED " + std::to_string(toExecuteTestsCount) + " UNIT TESTS. " + std::to_string(successCount) + " successful, " + std::to_string(errorsCount) + " failed", isConsole, finalResult);
+		MeasureOverhead();
 	}
-	
-	void RegisterTest(const UnitTest& test)
+
+public:
+	BenchmarkClock(BenchmarkClock const&) = delete;
+	void operator=(BenchmarkClock const&) = delete;
+
+	static const BenchmarkClock& GetInstance()
 	{
-		m_registeredUnitTests.push_back(test);
+		static const BenchmarkClock clock;
+		return clock;
 	}
 
-	static UnitTestsManager& GetInstance()
+	uint64_t Start() const
 	{
-		static UnitTestsManager testsManager;
-		return testsManager;
+#ifdef AP_HAS_TSC
+		if (m_useTsc)
+		{
+			_mm_lfence();	// Do not let the read be executed before the preceding instructions
+			return __rdtsc();
+		}
+#endif
+		return SteadyNow();
 	}
 
-	void Check(bool exp, const std::string& code)
+	uint64_t Stop() const
 	{
-		if (!exp)
+#ifdef AP_HAS_TSC
+		if (m_useTsc)
 		{
-			m_currentTest.errorMsgs.push_back("CHECK failed on: " + code);
+			unsigned int aux;
+			const uint64_t ticks = __rdtscp(&aux);	// Waits for the measured instructions to complete
+			_mm_lfence();
+			return ticks;
 		}
+#endif
+		return SteadyNow();
 	}
-	
-	void Check(bool exp, const std::string& code, const std::string& debugPrint)
+
+	double ToNanoseconds(uint64_t ticks) const
 	{
-		if (!exp)
+		return static_cast<double>(ticks) * m_nsPerTick;
+	}
+
+	// Cost of a Start() Stop() pair, subtracted from every timed section
+	double GetOverhead() const
+	{
+		return m_overheadNs;
+	}
+
+	std::string GetDescription() const
+	{
+		char buffer[96];
+
+		if (m_useTsc)
+			snprintf(buffer, sizeof(buffer), "invariant TSC at %.3f GHz, overhead %.1f ns", 1.0 / m_nsPerTick, m_overheadNs);
+		else
+			snprintf(buffer, sizeof(buffer), "steady_clock, overhead %.1f ns", m_overheadNs);
+
+		return buffer;
+	}
+
+private:
+	static uint64_t SteadyNow()
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	static bool HasInvariantTsc()
+	{
+#ifdef AP_HAS_TSC
+#ifdef _MSC_VER
+		int registers[4];
+		__cpuid(registers, 0x80000000);
+
+		if (static_cast<unsigned int>(registers[0]) < 0x80000007)
+			return false;
+
+		__cpuid(registers, 0x80000007);
+		return (registers[3] & (1 << 8)) != 0;
+#else
+		unsigned int eax, ebx, ecx, edx;
+
+		if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007 || !__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+			return false;
+
+		return (edx & (1 << 8)) != 0;
+#endif
+#else
+		return false;
+#endif
+	}
+
+	// steady_clock is CLOCK_MONOTONIC on Linux and QueryPerformanceCounter on Windows
+	void Calibrate()
+	{
+		const uint64_t startNs = SteadyNow();
+		const uint64_t startTicks = Start();
+		uint64_t endNs = startNs;
+
+		while (endNs - startNs < 20000000)
 		{
-			m_currentTest.errorMsgs.push_back("CHECK failed on: " + code + "  -  " + debugPrint);
+			endNs = SteadyNow();
 		}
+
+		const uint64_t endTicks = Stop();
+		m_nsPerTick = static_cast<double>(endNs - startNs) / static_cast<double>(endTicks - startTicks);
 	}
-	
-	void Require(bool exp, const std::string& code)
+
+	void MeasureOverhead()
 	{
-		if (!exp)
+		uint64_t minTicks = UINT64_MAX;
+
+		for (int i = 0; i < 10000; ++i)
 		{
-			m_currentTest.errorMsgs.push_back("REQUIRE failed on: " + code);
-			
-			throw APFailException();
+			const uint64_t start = Start();
+			const uint64_t end = Stop();
+			minTicks = (std::min)(minTicks, end - start);
 		}
+
+		m_overheadNs = ToNanoseconds(minTicks);
 	}
-	
-	void Require(bool exp, const std::string& code, const std::string& debugPrint)
+};
+
+// Detects the usual sources of benchmark noise and optionally pins the benchmark threads on dedicated CPUs
+class BenchmarkEnvironment
+{
+	std::vector<int> m_cpus;
+	bool m_raisePriority = false;
+
+#ifdef __linux__
+	cpu_set_t m_originalAffinity;
+	int m_originalPolicy = SCHED_OTHER;
+	sched_param m_originalParam;
+	int m_originalNice = 0;
+#endif
+
+	BenchmarkEnvironment() = default;
+
+public:
+	BenchmarkEnvironment(BenchmarkEnvironment const&) = delete;
+	void operator=(BenchmarkEnvironment const&) = delete;
+
+	static BenchmarkEnvironment& GetInstance()
 	{
-		if (!exp)
-		{
-			m_currentTest.errorMsgs.push_back("REQUIRE failed on: " + code + "  -  " + debugPrint);
+		static BenchmarkEnvironment environment;
+		return environment;
+	}
 
-			throw APFailException();
-		}
+	// The calling thread is pinned on the first CPU, the threads of multi-threaded benchmarks are spread over all of them
+	void SetCpus(const std::vector<int>& cpus, bool raisePriority)
+	{
+		m_cpus = cpus;
+		m_raisePriority = raisePriority;
 	}
 
-private:
-	static void Write(std::ostream& output, const std::string& msg, bool isConsole, TestResult result = TestResult::DEFAULT)
+	std::vector<std::string> GetWarnings() const
 	{
-		if (isConsole)
+		std::vector<std::string> warnings;
+
+#ifdef __linux__
+		const unsigned int cpusCount = (std::max)(std::thread::hardware_concurrency(), 1u);
+		unsigned int notPerformanceCount = 0;
+		std::string governor;
+
+		for (unsigned int cpu = 0; cpu < cpusCount; ++cpu)
 		{
-#ifdef _WIN32
-			switch (result)
+			const std::string cpuGovernor = ReadFirstWord("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cpufreq/scaling_governor");
+
+			if (!cpuGovernor.empty() && cpuGovernor != "performance")
 			{
-			case TestResult::SUCCESS:
-				SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_GREEN | FOREGROUND_INTENSITY);
-				break;
-			case TestResult::FAILURE:
-				SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_INTENSITY);
-				break;
+				governor = cpuGovernor;
+				++notPerformanceCount;
 			}
-#endif
 		}
 
-		output << msg << '\n';
+		if (notPerformanceCount > 0)
+			warnings.push_back("CPU frequency scaling governor is '" + governor + "' on " + std::to_string(notPerformanceCount) + " CPUs instead of 'performance'");
+
+		if (ReadFirstWord("/sys/devices/system/cpu/intel_pstate/no_turbo") == "0" || ReadFirstWord("/sys/devices/system/cpu/cpufreq/boost") == "1")
+			warnings.push_back("Turbo boost is enabled, the frequency depends on the temperature and on the load of the other cores");
 
-		if (isConsole)
+		if (ReadFirstWord("/sys/devices/system/cpu/smt/active") == "1")
+			warnings.push_back("SMT is active, a sibling hardware thread can share the core of the benchmark");
+
+		double load = 0.0;
+		if (getloadavg(&load, 1) == 1 && load >= 1.0)
 		{
-#ifdef _WIN32
-			SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 7);	// Reset to default color
+			char buffer[96];
+			snprintf(buffer, sizeof(buffer), "System load average is %.2f on %u CPUs", load, cpusCount);
+			warnings.push_back(buffer);
+		}
+
+		const std::string isolated = ReadFirstWord("/sys/devices/system/cpu/isolated");
+		for (int cpu : m_cpus)
+		{
+			if (!IsInCpuList(isolated, cpu))
+				warnings.push_back("CPU " + std::to_string(cpu) + " is not isolated (isolcpus), other tasks can be scheduled on it");
+		}
+#endif
+
+		return warnings;
+	}
+
+	// Pin the calling thread and raise its priority, returns the warnings for the settings that could not be applied
+	std::vector<std::string> Apply()
+	{
+		std::vector<std::string> warnings;
+
+		if (m_cpus.empty())
+			return warnings;
+
+#ifdef __linux__
+		sched_getaffinity(0, sizeof(m_originalAffinity), &m_originalAffinity);
+		m_originalPolicy = sched_getscheduler(0);
+		sched_getparam(0, &m_originalParam);
+		m_originalNice = getpriority(PRIO_PROCESS, 0);
+
+		if (!PinCurrentThread(0))
+			warnings.push_back("Failed to pin the benchmark thread on CPU " + std::to_string(m_cpus.front()));
+
+		if (m_raisePriority)
+		{
+			sched_param param;
+			param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+
+			if (sched_setscheduler(0, SCHED_FIFO, &param) != 0 && setpriority(PRIO_PROCESS, 0, -20) != 0)
+				warnings.push_back("Failed to raise the benchmark thread priority, SCHED_FIFO and negative nice values require CAP_SYS_NICE");
+		}
+#elif defined(_WIN32)
+		if (!PinCurrentThread(0))
+			warnings.push_back("Failed to pin the benchmark thread on CPU " + std::to_string(m_cpus.front()));
+
+		if (m_raisePriority && !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST))
+			warnings.push_back("Failed to raise the benchmark thread priority");
+#else
+		warnings.push_back("CPU pinning is not supported on this platform");
 #endif
+
+		return warnings;
+	}
+
+	void Restore()
+	{
+		if (m_cpus.empty())
+			return;
+
+#ifdef __linux__
+		sched_setaffinity(0, sizeof(m_originalAffinity), &m_originalAffinity);
+
+		if (m_raisePriority)
+		{
+			sched_setscheduler(0, m_originalPolicy, &m_originalParam);
+			setpriority(PRIO_PROCESS, 0, m_originalNice);
 		}
+#elif defined(_WIN32)
+		SetThreadAffinityMask(GetCurrentThread(), ~static_cast<DWORD_PTR>(0));
+
+		if (m_raisePriority)
+			SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_NORMAL);
+#endif
 	}
-	
-	void SortTests()
+
+	bool PinCurrentThread(int threadIndex) const
 	{
-		std::sort(m_registeredUnitTests.begin(), m_registeredUnitTests.end(), [](UnitTest& left, UnitTest& right)
+		if (m_cpus.empty())
+			return true;
+
+		const int cpu = m_cpus[threadIndex % m_cpus.size()];
+
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		return (sched_setaffinity(0, sizeof(set), &set) == 0);
+#elif defined(_WIN32)
+		return (SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu) != 0);
+#else
+		(void)cpu;
+		return false;
+#endif
+	}
+
+private:
+	static std::string ReadFirstWord(const std::string& path)
+	{
+		std::ifstream file(path);
+		std::string word;
+		file >> word;
+		return word;
+	}
+
+	// Parses the kernel CPU list format, for instance "2-5,8"
+	static bool IsInCpuList(const std::string& list, int cpu)
+	{
+		size_t position = 0;
+
+		while (position < list.size())
 		{
-			return (left.GetFullName() < right.GetFullName());
-		});
+			const size_t end = (std::min)(list.find(',', position), list.size());
+			const std::string range = list.substr(position, end - position);
+			const size_t dash = range.find('-');
+			const int first = std::atoi(range.c_str());
+			const int last = (dash == std::string::npos) ? first : std::atoi(range.c_str() + dash + 1);
+
+			if (cpu >= first && cpu <= last)
+				return true;
+
+			position = end + 1;
+		}
+
+		return false;
 	}
 };
 
-class UnitTestAutoRegister
+enum class CounterKind
+{
+	ABSOLUTE_VALUE,	// Reported as is, averaged over the threads
+	RATE_PER_SECOND	// Summed over the threads and divided by the elapsed time
+};
+
+class CacheFlusher
 {
 public:
-	UnitTestAutoRegister(const UnitTest& test)
+	// Flush only the given memory range, much faster than evicting everything when the working set of the benchmark is known
+	static void Flush(const void* data, size_t size)
 	{
-		UnitTestsManager::GetInstance().RegisterTest(test);
+#ifdef AP_HAS_TSC
+		const char* bytes = static_cast<const char*>(data);
+
+		if (size == 0)
+			return;
+
+		for (size_t offset = 0; offset < size; offset += 64)
+		{
+			_mm_clflush(bytes + offset);
+		}
+
+		_mm_clflush(bytes + size - 1);
+		_mm_mfence();
+#else
+		(void)data;
+		(void)size;
+		EvictAll();
+#endif
 	}
-};
 
-#define AP_CONCAT_IMPL( x, y )		x##y
-#define AP_MACRO_CONCAT( x, y )	AP_CONCAT_IMPL( x, y )
+	// Stream over a buffer 1.5 times larger than the biggest cache, which also evicts most of the TLB entries
+	static void EvictAll()
+	{
+		static const std::vector<char> buffer(GetLargestCacheSize() * 3 / 2, 1);
+		size_t sum = 0;
 
-// Test macros
-#define UNIT_TEST(_name)			static UnitTestAutoRegister AP_MACRO_CONCAT(testRegister_, __COUNTER__)(UnitTest(_name, []() -> void
-#define UNIT_TEST_END				));
-#define CHECK(_exp)					UnitTestsManager::GetInstance().Check(_exp, #_exp);
-#define CHECK_PRINT(_exp, _deb)		UnitTestsManager::GetInstance().Check(_exp, #_exp, _deb);
-#define REQUIRE(_exp)				UnitTestsManager::GetInstance().Require(_exp, #_exp);
-#define REQUIRE_PRINT(_exp, _deb)	UnitTestsManager::GetInstance().Require(_exp, #_exp, _deb);
\ No newline at end of file
+		for (size_t offset = 0; offset < buffer.size(); offset += 64)
+		{
+			sum += static_cast<size_t>(buffer[offset]);
+		}
+
+		DoNotOptimize(sum);
+	}
+
+	static size_t GetLargestCacheSize()
+	{
+		size_t largest = 0;
+
+#ifdef __linux__
+		for (int index = 0; index < 16; ++index)
+		{
+			std::ifstream file("/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/size");
+			size_t size = 0;
+			char unit = 0;
+
+			if (!(file >> size))
+				break;
+
+			if (file >> unit)
+				size <<= (unit == 'K') ? 10 : (unit == 'M') ? 20 : (unit == 'G') ? 30 : 0;
+
+			largest = (std::max)(largest, size);
+		}
+#endif
+
+		return (largest > 0) ? largest : (static_cast<size_t>(32) << 20);
+	}
+};
+
+class BenchmarkState
+{
+	friend class Benchmark;
+
+	struct Counter
+	{
+		double value;
+		CounterKind kind;
+	};
+
+	int64_t m_arg = 0;
+	uint64_t m_iterations = 0;
+	uint64_t m_remaining = 0;
+	uint64_t m_nextStop = 0;	// Value of m_remaining at which KeepRunning leaves its fast path
+	uint64_t m_batchSize = 0;
+	std::function<void(uint64_t)> m_batchSetup;
+	bool m_coldCache = false;
+	const void* m_workingSet = nullptr;
+	size_t m_workingSetSize = 0;
+	int m_threadIndex = 0;
+	int m_threadsCount = 1;
+	bool m_started = false;
+	SpinBarrier* m_startBarrier = nullptr;
+	const BenchmarkClock* m_clock = &BenchmarkClock::GetInstance();
+	uint64_t m_start = 0;
+	uint64_t m_firstStart = 0;	// Right after the start barrier
+	uint64_t m_stop = 0;		// End of the last timed section, the end of the run once KeepRunning returned false
+	uint64_t m_elapsedTicks = 0;
+	uint64_t m_timedSections = 0;
+	int64_t m_bytesProcessed = 0;
+	int64_t m_itemsProcessed = 0;
+	std::map<std::string, Counter> m_counters;
+
+	void Reset(int64_t arg, uint64_t iterations, int threadIndex, int threadsCount, SpinBarrier* startBarrier, bool coldCache = false, uint64_t batchSize = 0)
+	{
+		m_arg = arg;
+		m_iterations = iterations;
+		m_remaining = iterations;
+		m_nextStop = iterations;
+		m_batchSize = batchSize;
+		m_batchSetup = nullptr;
+		m_coldCache = coldCache;
+		m_workingSet = nullptr;
+		m_workingSetSize = 0;
+		m_threadIndex = threadIndex;
+		m_threadsCount = threadsCount;
+		m_started = false;
+		m_startBarrier = startBarrier;
+		m_elapsedTicks = 0;
+		m_timedSections = 0;
+		m_bytesProcessed = 0;
+		m_itemsProcessed = 0;
+		m_counters.clear();
+	}
+
+	void Start()
+	{
+		m_started = true;
+
+		if (m_startBarrier)
+		{
+			m_startBarrier->Wait();
+		}
+
+		m_start = m_clock->Start();
+		m_firstStart = m_start;
+	}
+
+	double GetElapsedNanoseconds() const
+	{
+		return (std::max)(m_clock->ToNanoseconds(m_elapsedTicks) - m_clock->GetOverhead() * static_cast<double>(m_timedSections), 0.0);
+	}
+
+	// Called on the first iteration, at each batch boundary and at the end, so that the timer is only read twice per batch
+	bool KeepRunningSlowPath()
+	{
+		if (m_started)
+		{
+			PauseTiming();
+		}
+
+		if (m_remaining == 0)
+		{
+			return false;
+		}
+
+		const uint64_t batchIterations = (m_batchSize > 0) ? (std::min)(m_batchSize, m_remaining) : m_remaining;
+
+		if (m_batchSetup)
+		{
+			m_batchSetup(batchIterations);
+		}
+
+		if (m_coldCache)
+		{
+			if (m_workingSet)
+				CacheFlusher::Flush(m_workingSet, m_workingSetSize);
+			else
+				CacheFlusher::EvictAll();
+		}
+
+		if (m_started)
+			ResumeTiming();
+		else
+			Start();
+
+		m_nextStop = m_remaining - batchIterations;
+		--m_remaining;
+		return true;
+	}
+
+public:
+	bool KeepRunning()
+	{
+		if (m_remaining != m_nextStop)
+		{
+			--m_remaining;
+			return true;
+		}
+
+		return KeepRunningSlowPath();
+	}
+
+	// Each call reads the timer, prefer SetBatchSetup to exclude work that has to be redone on every iteration
+	void PauseTiming()
+	{
+		m_stop = m_clock->Stop();
+		m_elapsedTicks += m_stop - m_start;
+		++m_timedSections;
+	}
+
+	void ResumeTiming()
+	{
+		m_start = m_clock->Start();
+	}
+
+	// Untimed setup called before the first iteration and then every batchSize iterations with the number of iterations of the coming batch
+	void SetBatchSetup(uint64_t batchSize, const std::function<void(uint64_t)>& setup)
+	{
+		m_batchSize = batchSize;
+		m_batchSetup = setup;
+	}
+
+	// In cold cache mode, only this memory is flushed from the caches instead of evicting everything
+	void SetWorkingSet(const void* data, size_t size)
+	{
+		m_workingSet = data;
+		m_workingSetSize = size;
+	}
+
+	int64_t GetArg() const
+	{
+		return m_arg;
+	}
+
+	uint64_t GetIterations() const
+	{
+		return m_iterations;
+	}
+
+	int GetThreadIndex() const
+	{
+		return m_threadIndex;
+	}
+
+	int GetThreadsCount() const
+	{
+		return m_threadsCount;
+	}
+
+	// Total processed by this thread during the run, usually GetIterations() * size of one operation
+	void SetBytesProcessed(int64_t bytes)
+	{
+		m_bytesProcessed = bytes;
+	}
+
+	void SetItemsProcessed(int64_t items)
+	{
+		m_itemsProcessed = items;
+	}
+
+	void SetCounter(const std::string& name, double value, CounterKind kind = CounterKind::ABSOLUTE_VALUE)
+	{
+		m_counters[name] = { value, kind };
+	}
+};
+
+class Benchmark
+{
+public:
+	struct Measure
+	{
+		int64_t arg;
+		int threads;
+		uint64_t iterations;	// Per thread
+		double nsPerOp;			// Average latency seen by each thread
+		double opsPerSecond;	// Aggregated over all the threads, from the release of the start barrier to the end of the last thread
+		double bytesPerSecond;
+		double itemsPerSecond;
+		std::map<std::string, std::pair<double, CounterKind>> counters;
+	};
+
+	struct ComplexityFit
+	{
+		Complexity complexity;
+		double coefficient;
+		double rms;
+	};
+
+private:
+	std::function<void(BenchmarkState&)> m_benchmarkCode;
+	std::string m_fullName;
+	BenchmarkOptions m_options;
+
+public:
+	Benchmark(const std::string& fullName, const BenchmarkOptions& options, const std::function<void(BenchmarkState&)> code)
+		: m_benchmarkCode(code)
+		, m_fullName(fullName)
+		, m_options(options)
+	{
+	}
+
+	// Without fixedIterations, the number of iterations grows until the run lasts at least the minimal time
+	bool Run(int64_t arg, int threads, Measure& measure, std::string& exceptionError, uint64_t fixedIterations = 0, bool coldCache = false) const
+	{
+		std::vector<BenchmarkState> states(threads);
+		uint64_t iterations = (fixedIterations > 0) ? fixedIterations : 1;
+		double elapsed = 0.0;
+
+		try
+		{
+			while (true)
+			{
+				SpinBarrier startBarrier(threads);
+
+				for (int i = 0; i < threads; ++i)
+				{
+					states[i].Reset(arg, iterations, i, threads, (threads > 1) ? &startBarrier : nullptr, coldCache, coldCache ? m_options.coldBatchSize : 0);
+				}
+
+				RunThreads(states);
+
+				elapsed = 0.0;
+				for (const BenchmarkState& state : states)
+				{
+					if (state.m_remaining != 0)
+					{
+						exceptionError = "the benchmark body must loop on state.KeepRunning()";
+						return false;
+					}
+
+					elapsed = (std::max)(elapsed, state.GetElapsedNanoseconds());
+				}
+
+				const double minTime = static_cast<double>(m_options.minTime.count());
+
+				if (fixedIterations > 0 || elapsed >= minTime || iterations >= 1000000000)
+				{
+					break;
+				}
+
+				// Aim slightly above the minimal time, without growing more than 10x per attempt since the first runs are the noisiest
+				const double multiplier = (elapsed > 0.0) ? (minTime * 1.4 / elapsed) : 10.0;
+				iterations = static_cast<uint64_t>(static_cast<double>(iterations) * (std::min)((std::max)(multiplier, 2.0), 10.0));
+			}
+		}
+		catch (const APFailException&)
+		{
+			return false;
+		}
+		catch (const std::exception& e)
+		{
+			exceptionError = e.what();
+			return false;
+		}
+
+		// The throughput of several threads is measured on the wall clock: a thread descheduled or starting late must not inflate it.
+		// The untimed sections of the least paused thread are excluded, like the untimed sections of a single thread
+		if (threads > 1)
+		{
+			uint64_t release = UINT64_MAX;
+			uint64_t end = 0;
+			uint64_t minPausedTicks = UINT64_MAX;
+
+			for (const BenchmarkState& state : states)
+			{
+				release = (std::min)(release, state.m_firstStart);
+				end = (std::max)(end, state.m_stop);
+				minPausedTicks = (std::min)(minPausedTicks, state.m_stop - state.m_firstStart - state.m_elapsedTicks);
+			}
+
+			const double wallTime = BenchmarkClock::GetInstance().ToNanoseconds(end - release - minPausedTicks);
+			elapsed = (std::max)(wallTime, elapsed);
+		}
+
+		const double elapsedSeconds = elapsed / 1e9;
+		double totalThreadsTime = 0.0;
+		double totalBytes = 0.0;
+		double totalItems = 0.0;
+		measure.counters.clear();
+
+		for (const BenchmarkState& state : states)
+		{
+			totalThreadsTime += state.GetElapsedNanoseconds();
+			totalBytes += static_cast<double>(state.m_bytesProcessed);
+			totalItems += static_cast<double>(state.m_itemsProcessed);
+
+			for (const auto& counter : state.m_counters)
+			{
+				const double value = (counter.second.kind == CounterKind::RATE_PER_SECOND) ? (counter.second.value / elapsedSeconds) : (counter.second.value / threads);
+				auto& aggregated = measure.counters[counter.first];
+				aggregated.first += value;
+				aggregated.second = counter.second.kind;
+			}
+		}
+
+		const double totalOps = static_cast<double>(iterations) * static_cast<double>(threads);
+
+		measure.arg = arg;
+		measure.threads = threads;
+		measure.iterations = iterations;
+		measure.nsPerOp = totalThreadsTime / totalOps;
+		measure.opsPerSecond = (elapsed > 0.0) ? (totalOps / elapsedSeconds) : 0.0;
+		measure.bytesPerSecond = (elapsed > 0.0) ? (totalBytes / elapsedSeconds) : 0.0;
+		measure.itemsPerSecond = (elapsed > 0.0) ? (totalItems / elapsedSeconds) : 0.0;
+		return true;
+	}
+
+	// Least squares fit of time = coefficient * f(n) for each complexity model, the model with the lowest normalized RMS wins
+	static ComplexityFit FitComplexity(const std::vector<Measure>& measures)
+	{
+		const Complexity models[] = { Complexity::CONSTANT, Complexity::LOGARITHMIC, Complexity::LINEAR, Complexity::LINEARITHMIC, Complexity::QUADRATIC };
+		ComplexityFit best = { Complexity::UNSPECIFIED, 0.0, 0.0 };
+
+		double meanTime = 0.0;
+		for (const Measure& measure : measures)
+		{
+			meanTime += measure.nsPerOp;
+		}
+		meanTime /= static_cast<double>(measures.size());
+
+		for (Complexity model : models)
+		{
+			double sumTimeByFn = 0.0;
+			double sumFnSquared = 0.0;
+
+			for (const Measure& measure : measures)
+			{
+				const double fn = ComplexityFunction(model, static_cast<double>(measure.arg));
+				sumTimeByFn += measure.nsPerOp * fn;
+				sumFnSquared += fn * fn;
+			}
+
+			const double coefficient = sumTimeByFn / sumFnSquared;
+			double sumSquaredErrors = 0.0;
+
+			for (const Measure& measure : measures)
+			{
+				const double error = measure.nsPerOp - coefficient * ComplexityFunction(model, static_cast<double>(measure.arg));
+				sumSquaredErrors += error * error;
+			}
+
+			const double rms = std::sqrt(sumSquaredErrors / static_cast<double>(measures.size())) / meanTime;
+
+			if (best.complexity == Complexity::UNSPECIFIED || rms < best.rms)
+			{
+				best = { model, coefficient, rms };
+			}
+		}
+
+		return best;
+	}
+
+	static double ComplexityFunction(Complexity complexity, double n)
+	{
+		switch (complexity)
+		{
+		case Complexity::LOGARITHMIC:
+			return std::log2((std::max)(n, 2.0));
+		case Complexity::LINEAR:
+			return n;
+		case Complexity::LINEARITHMIC:
+			return n * std::log2((std::max)(n, 2.0));
+		case Complexity::QUADRATIC:
+			return n * n;
+		default:
+			return 1.0;
+		}
+	}
+
+	static std::string ComplexityToString(Complexity complexity)
+	{
+		switch (complexity)
+		{
+		case Complexity::CONSTANT:
+			return "O(1)";
+		case Complexity::LOGARITHMIC:
+			return "O(log N)";
+		case Complexity::LINEAR:
+			return "O(N)";
+		case Complexity::LINEARITHMIC:
+			return "O(N log N)";
+		case Complexity::QUADRATIC:
+			return "O(N^2)";
+		default:
+			return "O(?)";
+		}
+	}
+
+	std::string GetFullName() const
+	{
+		return m_fullName;
+	}
+
+	const BenchmarkOptions& GetOptions() const
+	{
+		return m_options;
+	}
+
+private:
+	void RunThreads(std::vector<BenchmarkState>& states) const
+	{
+		if (states.size() == 1)
+		{
+			m_benchmarkCode(states.front());
+			return;
+		}
+
+		std::vector<std::thread> threads;
+		std::vector<std::exception_ptr> exceptions(states.size());
+
+		for (size_t i = 0; i < states.size(); ++i)
+		{
+			threads.emplace_back([this, &states, &exceptions, i]()
+			{
+				BenchmarkEnvironment::GetInstance().PinCurrentThread(static_cast<int>(i));
+
+				try
+				{
+					m_benchmarkCode(states[i]);
+				}
+				catch (...)
+				{
+					exceptions[i] = std::current_exception();
+				}
+
+				if (!states[i].m_started)
+				{
+					states[i].m_startBarrier->Wait();	// Release the other threads even if this one never reached KeepRunning
+				}
+			});
+		}
+
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		for (const std::exception_ptr& exception : exceptions)
+		{
+			if (exception)
+			{
+				std::rethrow_exception(exception);
+			}
+		}
+	}
+};
+
+// Interleaves the repetitions of two implementations in randomized AB or BA blocks, so that frequency and thermal drift affect both equally
+class BenchmarkComparison
+{
+public:
+	struct Result
+	{
+		int64_t arg;
+		double baselineNsPerOp;
+		double candidateNsPerOp;
+		double speedup;	// Baseline time divided by candidate time, above 1 when the candidate is faster
+		double speedupLow;
+		double speedupHigh;
+		int blocks;
+	};
+
+private:
+	std::string m_fullName;
+	BenchmarkOptions m_options;
+	Benchmark m_baseline;
+	Benchmark m_candidate;
+
+public:
+	BenchmarkComparison(const std::string& fullName, const BenchmarkOptions& options, const std::function<void(BenchmarkState&)> baseline, const std::function<void(BenchmarkState&)> candidate)
+		: m_fullName(fullName)
+		, m_options(options)
+		, m_baseline(fullName, BenchmarkOptions(options).MinTime(options.minTime / 10), baseline)
+		, m_candidate(fullName, BenchmarkOptions(options).MinTime(options.minTime / 10), candidate)
+	{
+	}
+
+	bool Run(int64_t arg, Result& result, std::string& exceptionError) const
+	{
+		Benchmark::Measure calibration;
+
+		if (!m_baseline.Run(arg, 1, calibration, exceptionError))
+		{
+			return false;
+		}
+
+		std::mt19937 random(std::random_device{}());
+		std::vector<double> logRatios;
+		double baselineTotal = 0.0;
+		double candidateTotal = 0.0;
+
+		for (int block = 0; block < m_options.comparisonBlocks; ++block)
+		{
+			Benchmark::Measure baselineMeasure;
+			Benchmark::Measure candidateMeasure;
+			const bool baselineFirst = (random() & 1) != 0;
+
+			if (!(baselineFirst ? m_baseline : m_candidate).Run(arg, 1, baselineFirst ? baselineMeasure : candidateMeasure, exceptionError, calibration.iterations))
+				return false;
+
+			if (!(baselineFirst ? m_candidate : m_baseline).Run(arg, 1, baselineFirst ? candidateMeasure : baselineMeasure, exceptionError, calibration.iterations))
+				return false;
+
+			logRatios.push_back(std::log(baselineMeasure.nsPerOp / candidateMeasure.nsPerOp));
+			baselineTotal += baselineMeasure.nsPerOp;
+			candidateTotal += candidateMeasure.nsPerOp;
+		}
+
+		// 95% confidence interval of the geometric mean of the per block ratios
+		const double count = static_cast<double>(logRatios.size());
+		double mean = 0.0;
+		for (double logRatio : logRatios)
+		{
+			mean += logRatio;
+		}
+		mean /= count;
+
+		double variance = 0.0;
+		for (double logRatio : logRatios)
+		{
+			variance += (logRatio - mean) * (logRatio - mean);
+		}
+		variance /= (count - 1.0);
+
+		const double margin = StudentT95(static_cast<int>(logRatios.size()) - 1) * std::sqrt(variance / count);
+
+		result.arg = arg;
+		result.baselineNsPerOp = baselineTotal / count;
+		result.candidateNsPerOp = candidateTotal / count;
+		result.speedup = std::exp(mean);
+		result.speedupLow = std::exp(mean - margin);
+		result.speedupHigh = std::exp(mean + margin);
+		result.blocks = static_cast<int>(logRatios.size());
+		return true;
+	}
+
+	std::string GetFullName() const
+	{
+		return m_fullName;
+	}
+
+	const BenchmarkOptions& GetOptions() const
+	{
+		return m_options;
+	}
+
+private:
+	static double StudentT95(int degreesOfFreedom)
+	{
+		static const double table[] = { 12.71, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+
+		if (degreesOfFreedom <= 0)
+			return table[0];
+
+		return (degreesOfFreedom <= 30) ? table[degreesOfFreedom - 1] : 1.96;
+	}
+};
+
+// Fixed memory histogram with logarithmic buckets (about 3% of relative precision), fed without locks through per-thread shards merged on read
+class LatencyHistogram
+{
+	static const int SUB_BUCKET_BITS = 5;
+	static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	static const int BUCKETS = 2 * SUB_BUCKETS + (63 - SUB_BUCKET_BITS) * SUB_BUCKETS;
+	static const int SHARDS = 8;
+
+	struct Shard
+	{
+		std::atomic<uint64_t> counts[BUCKETS];
+		std::atomic<uint64_t> max;
+	};
+
+	std::unique_ptr<Shard[]> m_shards;
+	std::atomic<bool> m_used;
+
+public:
+	LatencyHistogram()
+		: m_shards(new Shard[SHARDS]())
+		, m_used(false)
+	{
+	}
+
+	void Record(std::chrono::nanoseconds duration)
+	{
+		const uint64_t value = static_cast<uint64_t>((std::max)(duration.count(), static_cast<std::chrono::nanoseconds::rep>(0)));
+		Shard& shard = m_shards[GetThreadShard()];
+
+		shard.counts[GetBucket(value)].fetch_add(1, std::memory_order_relaxed);
+
+		uint64_t max = shard.max.load(std::memory_order_relaxed);
+		while (value > max && !shard.max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+		{
+		}
+
+		if (!m_used.load(std::memory_order_relaxed))
+		{
+			m_used.store(true, std::memory_order_relaxed);
+		}
+	}
+
+	bool IsUsed() const
+	{
+		return m_used.load(std::memory_order_relaxed);
+	}
+
+	void Reset()
+	{
+		for (int shardIndex = 0; shardIndex < SHARDS; ++shardIndex)
+		{
+			for (std::atomic<uint64_t>& count : m_shards[shardIndex].counts)
+			{
+				count.store(0, std::memory_order_relaxed);
+			}
+
+			m_shards[shardIndex].max.store(0, std::memory_order_relaxed);
+		}
+
+		m_used.store(false, std::memory_order_relaxed);
+	}
+
+	uint64_t GetCount() const
+	{
+		uint64_t count = 0;
+		for (uint64_t bucketCount : MergeShards())
+		{
+			count += bucketCount;
+		}
+
+		return count;
+	}
+
+	uint64_t GetMax() const
+	{
+		uint64_t max = 0;
+		for (int shardIndex = 0; shardIndex < SHARDS; ++shardIndex)
+		{
+			max = (std::max)(max, m_shards[shardIndex].max.load(std::memory_order_relaxed));
+		}
+
+		return max;
+	}
+
+	// Percentile between 0 and 100, in nanoseconds
+	uint64_t GetPercentile(double percentile) const
+	{
+		return GetPercentile(MergeShards(), percentile);
+	}
+
+	std::string GetSummary() const
+	{
+		const std::vector<uint64_t> counts = MergeShards();
+		uint64_t total = 0;
+
+		for (uint64_t count : counts)
+		{
+			total += count;
+		}
+
+		return "p50=" + FormatDuration(GetPercentile(counts, 50.0)) + " p90=" + FormatDuration(GetPercentile(counts, 90.0)) + " p99=" + FormatDuration(GetPercentile(counts, 99.0))
+			+ " p99.9=" + FormatDuration(GetPercentile(counts, 99.9)) + " max=" + FormatDuration(GetMax()) + " (" + std::to_string(total) + " samples)";
+	}
+
+	static std::string FormatDuration(uint64_t nanoseconds)
+	{
+		char buffer[32];
+
+		if (nanoseconds < 1000)
+			snprintf(buffer, sizeof(buffer), "%uns", static_cast<unsigned int>(nanoseconds));
+		else if (nanoseconds < 1000000)
+			snprintf(buffer, sizeof(buffer), "%.1fus", static_cast<double>(nanoseconds) / 1e3);
+		else if (nanoseconds < 1000000000)
+			snprintf(buffer, sizeof(buffer), "%.1fms", static_cast<double>(nanoseconds) / 1e6);
+		else
+			snprintf(buffer, sizeof(buffer), "%.2fs", static_cast<double>(nanoseconds) / 1e9);
+
+		return buffer;
+	}
+
+private:
+	static size_t GetThreadShard()
+	{
+		static std::atomic<size_t> nextShard(0);
+		thread_local const size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+		return shard;
+	}
+
+	// Values below 2 * SUB_BUCKETS are exact, above each power of two range is split into SUB_BUCKETS buckets
+	static int GetBucket(uint64_t value)
+	{
+		if (value < 2 * SUB_BUCKETS)
+			return static_cast<int>(value);
+
+		int highestBit = SUB_BUCKET_BITS + 1;
+		while ((value >> (highestBit + 1)) != 0)
+		{
+			++highestBit;
+		}
+
+		const int shift = highestBit - SUB_BUCKET_BITS;
+		return 2 * SUB_BUCKETS + (shift - 1) * SUB_BUCKETS + static_cast<int>((value >> shift) - SUB_BUCKETS);
+	}
+
+	static uint64_t GetBucketMiddle(int bucket)
+	{
+		if (bucket < 2 * SUB_BUCKETS)
+			return static_cast<uint64_t>(bucket);
+
+		const int shift = (bucket - 2 * SUB_BUCKETS) / SUB_BUCKETS + 1;
+		const uint64_t lowerBound = static_cast<uint64_t>((bucket - 2 * SUB_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS) << shift;
+		return lowerBound + ((static_cast<uint64_t>(1) << shift) >> 1);
+	}
+
+	std::vector<uint64_t> MergeShards() const
+	{
+		std::vector<uint64_t> counts(BUCKETS, 0);
+
+		for (int shardIndex = 0; shardIndex < SHARDS; ++shardIndex)
+		{
+			for (int bucket = 0; bucket < BUCKETS; ++bucket)
+			{
+				counts[bucket] += m_shards[shardIndex].counts[bucket].load(std::memory_order_relaxed);
+			}
+		}
+
+		return counts;
+	}
+
+	uint64_t GetPercentile(const std::vector<uint64_t>& counts, double percentile) const
+	{
+		uint64_t total = 0;
+		for (uint64_t count : counts)
+		{
+			total += count;
+		}
+
+		if (total == 0)
+			return 0;
+
+		const uint64_t rank = (std::max)(static_cast<uint64_t>(std::ceil(percentile / 100.0 * static_cast<double>(total))), static_cast<uint64_t>(1));
+		uint64_t seen = 0;
+
+		for (int bucket = 0; bucket < BUCKETS; ++bucket)
+		{
+			seen += counts[bucket];
+
+			if (seen >= rank)
+				return (std::min)(GetBucketMiddle(bucket), GetMax());
+		}
+
+		return GetMax();
+	}
+};
+
+// Bounded lock-free multi-producer multi-consumer queue (Dmitry Vyukov's algorithm), the capacity is rounded up to a power of two
+template <typename T>
+class BoundedQueue
+{
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	std::unique_ptr<Cell[]> m_cells;
+	size_t m_mask;
+	char m_padding1[64];	// Keep the producers and the consumers positions on different cache lines
+	std::atomic<size_t> m_enqueuePosition;
+	char m_padding2[64];
+	std::atomic<size_t> m_dequeuePosition;
+
+public:
+	explicit BoundedQueue(size_t capacity)
+	{
+		size_t size = 2;
+		while (size < capacity)
+		{
+			size *= 2;
+		}
+
+		m_cells.reset(new Cell[size]);
+		m_mask = size - 1;
+
+		for (size_t i = 0; i < size; ++i)
+		{
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		m_enqueuePosition.store(0, std::memory_order_relaxed);
+		m_dequeuePosition.store(0, std::memory_order_relaxed);
+	}
+
+	// The value is only moved from when the push succeeds
+	bool TryPush(T& value)
+	{
+		size_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+
+		while (true)
+		{
+			Cell& cell = m_cells[position & m_mask];
+			const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+			if (difference == 0)
+			{
+				if (m_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					cell.data = std::move(value);
+					cell.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (difference < 0)
+			{
+				return false;	// Full
+			}
+			else
+			{
+				position = m_enqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool TryPop(T& value)
+	{
+		size_t position = m_dequeuePosition.load(std::memory_order_relaxed);
+
+		while (true)
+		{
+			Cell& cell = m_cells[position & m_mask];
+			const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+
+			if (difference == 0)
+			{
+				if (m_dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					value = std::move(cell.data);
+					cell.sequence.store(position + m_mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (difference < 0)
+			{
+				return false;	// Empty
+			}
+			else
+			{
+				position = m_dequeuePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+};
+
+// Redirects the stdout and stderr file descriptors into a pipe while a test runs, so that printf and third party logging are captured too.
+// A reader thread drains the pipe into a ring buffer that keeps the last bytes written
+class OutputCapture
+{
+	static const char* GetMarker()
+	{
+		return "\x1b\x7f\x01AP_END_OF_TEST\x02\x7f\x1b";	// Written by the runner after each test to know when the reader has seen all of its output
+	}
+
+	std::vector<char> m_ring;
+	size_t m_ringStart = 0;
+	size_t m_ringSize = 0;
+	uint64_t m_droppedBytes = 0;
+	size_t m_markerMatched = 0;
+	bool m_markerFound = false;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::thread m_reader;
+	int m_pipe[2] = { -1, -1 };
+	int m_savedStdout = -1;
+	int m_savedStderr = -1;
+
+public:
+	explicit OutputCapture(size_t capacity)
+		: m_ring((std::max)(capacity, static_cast<size_t>(1)))
+	{
+	}
+
+	OutputCapture(OutputCapture const&) = delete;
+	void operator=(OutputCapture const&) = delete;
+
+	~OutputCapture()
+	{
+		Stop();
+	}
+
+	bool Start()
+	{
+#ifndef _WIN32
+		if (pipe(m_pipe) != 0)
+			return false;
+
+		m_reader = std::thread([this]()
+		{
+			char buffer[4096];
+
+			while (true)
+			{
+				const ssize_t readSize = read(m_pipe[0], buffer, sizeof(buffer));
+
+				if (readSize == 0 || (readSize < 0 && errno != EINTR))
+					break;
+
+				std::lock_guard<std::mutex> lock(m_mutex);
+				for (ssize_t i = 0; i < readSize; ++i)
+				{
+					Consume(buffer[i]);
+				}
+			}
+		});
+
+		return true;
+#else
+		return false;	// Not supported on Windows
+#endif
+	}
+
+	void Stop()
+	{
+#ifndef _WIN32
+		if (m_pipe[1] < 0)
+			return;
+
+		close(m_pipe[1]);
+		m_reader.join();
+		close(m_pipe[0]);
+		m_pipe[0] = m_pipe[1] = -1;
+#endif
+	}
+
+	void BeginTest()
+	{
+#ifndef _WIN32
+		std::cout.flush();
+		fflush(stdout);
+		fflush(stderr);
+
+		m_savedStdout = dup(STDOUT_FILENO);
+		m_savedStderr = dup(STDERR_FILENO);
+		dup2(m_pipe[1], STDOUT_FILENO);
+		dup2(m_pipe[1], STDERR_FILENO);
+#endif
+	}
+
+	// Restore the file descriptors and return what the test wrote, empty lines excluded
+	std::vector<std::string> EndTest()
+	{
+		std::vector<std::string> lines;
+
+#ifndef _WIN32
+		std::cout.flush();
+		std::cerr.flush();
+		fflush(stdout);
+		fflush(stderr);
+
+		const char* marker = GetMarker();
+		for (size_t written = 0; written < strlen(marker);)
+		{
+			const ssize_t writeSize = write(m_pipe[1], marker + written, strlen(marker) - written);
+
+			if (writeSize > 0)
+				written += static_cast<size_t>(writeSize);
+			else if (errno != EINTR)
+				break;
+		}
+
+		dup2(m_savedStdout, STDOUT_FILENO);
+		dup2(m_savedStderr, STDERR_FILENO);
+		close(m_savedStdout);
+		close(m_savedStderr);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_condition.wait(lock, [this]() { return m_markerFound; });
+		m_markerFound = false;
+
+		if (m_droppedBytes > 0)
+			lines.push_back("[" + std::to_string(m_droppedBytes) + " bytes of earlier output dropped]");
+
+		std::string line;
+		for (size_t i = 0; i < m_ringSize; ++i)
+		{
+			const char character = m_ring[(m_ringStart + i) % m_ring.size()];
+
+			if (character == '\n')
+			{
+				if (!line.empty())
+					lines.push_back(line);
+
+				line.clear();
+			}
+			else
+			{
+				line += character;
+			}
+		}
+
+		if (!line.empty())
+			lines.push_back(line);
+
+		m_ringStart = 0;
+		m_ringSize = 0;
+		m_droppedBytes = 0;
+#endif
+
+		return lines;
+	}
+
+private:
+	void Consume(char character)
+	{
+		const char* marker = GetMarker();
+
+		if (character == marker[m_markerMatched])
+		{
+			if (marker[++m_markerMatched] == '\0')
+			{
+				m_markerMatched = 0;
+				m_markerFound = true;
+				m_condition.notify_one();
+			}
+
+			return;
+		}
+
+		// Give back the partially matched marker bytes, it was regular output
+		for (size_t i = 0; i < m_markerMatched; ++i)
+		{
+			PushToRing(marker[i]);
+		}
+
+		m_markerMatched = 0;
+
+		if (character == marker[0])
+			m_markerMatched = 1;
+		else
+			PushToRing(character);
+	}
+
+	void PushToRing(char character)
+	{
+		if (m_ringSize == m_ring.size())
+		{
+			m_ringStart = (m_ringStart + 1) % m_ring.size();
+			--m_ringSize;
+			++m_droppedBytes;
+		}
+
+		m_ring[(m_ringStart + m_ringSize) % m_ring.size()] = character;
+		++m_ringSize;
+	}
+};
+
+// Append-only journal of the starts and the ends of the tests. On POSIX it is written through a shared memory mapping,
+// the records are in the page cache as soon as they are copied and survive a crash of the process
+class RunJournal
+{
+public:
+	struct Entry
+	{
+		bool success = false;
+		bool crashed = false;
+		std::chrono::nanoseconds duration{0};
+	};
+
+private:
+	int m_file = -1;
+	char* m_mapping = nullptr;
+	size_t m_capacity = 0;
+	size_t m_size = 0;
+
+public:
+	RunJournal() = default;
+	RunJournal(const RunJournal&) = delete;
+	RunJournal& operator=(const RunJournal&) = delete;
+
+	~RunJournal()
+	{
+		Close();
+	}
+
+	// When resuming, the tests completed in the journal are returned and the test that was in flight is recorded as crashed.
+	bool Open(const std::string& path, bool resume, std::map<std::string, Entry>& completedTests)
+	{
+		std::string content;
+		std::string inFlightTest;
+		size_t recordsEnd = 0;
+
+		if (resume)
+		{
+			std::ifstream file(path, std::ios::binary);
+			content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+			content.resize((std::min)(content.find('\0'), content.size()));	// The mapped space after the last record is zeroed
+			recordsEnd = content.size();
+			content.resize(content.rfind('\n') + 1);							// Drop a record interrupted by the crash
+
+			inFlightTest = Parse(content, completedTests);
+		}
+
+		// The recovered records are written back over themselves, so a crash while resuming still leaves them in the journal
+#ifdef _WIN32
+		m_file = _open(path.c_str(), _O_RDWR | _O_CREAT | _O_BINARY | (resume ? 0 : _O_TRUNC), _S_IREAD | _S_IWRITE);
+		if (m_file < 0)
+			return false;
+#else
+		m_file = open(path.c_str(), O_RDWR | O_CREAT | (resume ? 0 : O_TRUNC), 0644);
+		if (m_file < 0)
+			return false;
+#endif
+
+		Append(content);
+
+		if (!inFlightTest.empty())
+		{
+			Append("C " + inFlightTest + "\n");
+
+			Entry& entry = completedTests[inFlightTest];
+			entry.success = false;
+			entry.crashed = true;
+		}
+
+		// Clears what is left of the interrupted record, the records end at the first zero or at the end of the file
+#ifdef _WIN32
+		if (_chsize(m_file, static_cast<long>(m_size)) != 0)
+			return false;
+#else
+		if (m_size < recordsEnd && Reserve(recordsEnd))
+			memset(m_mapping + m_size, 0, recordsEnd - m_size);
+#endif
+
+		return true;
+	}
+
+	void RecordStart(const std::string& testName)
+	{
+		Append("S " + testName + "\n");
+	}
+
+	void RecordEnd(const std::string& testName, bool success, std::chrono::nanoseconds duration)
+	{
+		Append(std::string("E ") + (success ? "1 " : "0 ") + std::to_string(duration.count()) + " " + testName + "\n");
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (m_file >= 0)
+			_close(m_file);
+#else
+		if (m_mapping)
+			munmap(m_mapping, m_capacity);
+
+		if (m_file >= 0)
+		{
+			if (ftruncate(m_file, static_cast<off_t>(m_size)) != 0)
+				fprintf(stderr, "Failed to truncate the run journal: %s\n", strerror(errno));
+
+			close(m_file);
+		}
+#endif
+
+		m_file = -1;
+		m_mapping = nullptr;
+		m_capacity = 0;
+		m_size = 0;
+	}
+
+private:
+	void Append(const std::string& records)
+	{
+		if (m_file < 0 || records.empty())
+			return;
+
+#ifdef _WIN32
+		if (_write(m_file, records.data(), static_cast<unsigned int>(records.size())) < 0)
+			return;
+#else
+		if (!Reserve(m_size + records.size()))
+			return;
+
+		memcpy(m_mapping + m_size, records.data(), records.size());
+#endif
+
+		m_size += records.size();
+	}
+
+#ifndef _WIN32
+	bool Reserve(size_t size)
+	{
+		if (size <= m_capacity)
+			return true;
+
+		const size_t capacity = (std::max)(m_capacity * 2, (std::max)(size, static_cast<size_t>(64 * 1024)));
+
+		if (m_mapping)
+			munmap(m_mapping, m_capacity);
+
+		m_mapping = nullptr;
+		m_capacity = 0;
+
+		if (ftruncate(m_file, static_cast<off_t>(capacity)) != 0)
+			return false;
+
+		void* mapping = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+		if (mapping == MAP_FAILED)
+			return false;
+
+		m_mapping = static_cast<char*>(mapping);
+		m_capacity = capacity;
+		return true;
+	}
+#endif
+
+	// Records: "S <name>" when a test starts, "E <success> <nanoseconds> <name>" when it ends, "C <name>" when it crashed.
+	// Returns the test started without an end
+	static std::string Parse(const std::string& content, std::map<std::string, Entry>& completedTests)
+	{
+		std::string inFlightTest;
+		size_t position = 0;
+
+		while (position < content.size())
+		{
+			const size_t end = content.find('\n', position);
+			const std::string record = content.substr(position, end - position);
+			position = end + 1;
+
+			if (record.size() < 3)
+				continue;
+
+			if (record[0] == 'S')
+			{
+				inFlightTest = record.substr(2);
+			}
+			else if (record[0] == 'E' && record.size() > 4)
+			{
+				char* name = nullptr;
+				const uint64_t nanoseconds = strtoull(record.c_str() + 4, &name, 10);
+
+				if (*name != ' ')
+					continue;
+
+				Entry& entry = completedTests[name + 1];
+				entry.success = (record[2] == '1');
+				entry.crashed = false;
+				entry.duration = std::chrono::nanoseconds(nanoseconds);
+				inFlightTest.clear();
+			}
+			else if (record[0] == 'C')
+			{
+				Entry& entry = completedTests[record.substr(2)];
+				entry.success = false;
+				entry.crashed = true;
+				inFlightTest.clear();
+			}
+		}
+
+		return inFlightTest;
+	}
+};
+
+enum class OutputMode
+{
+	VERBOSE,		// One line per test
+	FAILURES_ONLY,	// Only the failed tests are printed
+	PROGRESS,		// Failed tests and a single progress line, updated at most every 100 ms
+	NONE			// Nothing is written, the results are only returned
+};
+
+// Shared between the copies, Cancel can be called from any thread
+class CancellationToken
+{
+	std::shared_ptr<std::atomic<bool>> m_cancelled;
+
+public:
+	CancellationToken() : m_cancelled(std::make_shared<std::atomic<bool>>(false))
+	{
+	}
+
+	void Cancel()
+	{
+		m_cancelled->store(true, std::memory_order_relaxed);
+	}
+
+	bool IsCancelled() const
+	{
+		return m_cancelled->load(std::memory_order_relaxed);
+	}
+};
+
+struct TestOutcome
+{
+	std::string name;
+	bool success = false;
+	std::chrono::nanoseconds duration{0};
+	std::vector<std::string> failures;	// Failed checks and exception
+};
+
+struct RunOptions
+{
+	OutputMode outputMode = OutputMode::VERBOSE;
+	bool captureOutput = false;					// Capture stdout and stderr of each test, printed only for the failed tests
+	size_t captureBufferSize = 64 * 1024;		// Bytes of captured output kept per test, the oldest ones are dropped first
+	bool asyncReporting = false;				// Format and write the results on a dedicated thread, so that a slow output does not slow the tests down
+	size_t reportQueueCapacity = 1024;			// Results waiting to be written, the tests wait when the queue is full
+	CancellationToken cancellation;				// The tests not started yet are skipped once cancelled
+	int maxFailures = 0;						// Fail-fast, the remaining tests are skipped after this many failures. 0 for no limit
+	std::string journalPath;					// Journal recording the start and the end of each test, empty for none
+	std::vector<std::string> skipSuites;		// Suites not run, for instance "Network" or "Network:Slow"
+	int suiteSummaryDepth = 1;					// Levels of suites summarized after the run, 0 for none
+	bool resume = false;						// Take the results of the tests completed in the journal instead of running them again
+	std::chrono::nanoseconds timeBudget{0};		// The tests not started before it expires are skipped, 0 for no budget
+	std::function<void(const TestOutcome&)> onTestDone;	// Called on the running thread after each test
+};
+
+struct SuiteResult
+{
+	std::string name;		// Full name of the suite, for instance "Network:Slow"
+	int depth = 0;			// 1 for the top-level suites
+	int executedCount = 0;
+	int successCount = 0;
+	int failedCount = 0;
+	std::chrono::nanoseconds duration{0};
+};
+
+struct TestRunResult
+{
+	int executedCount = 0;
+	int successCount = 0;
+	int failedCount = 0;
+	int skippedCount = 0;				// Not started because of a cancellation or of the time budget
+	int resumedCount = 0;				// Results read back from the journal, included in the other counts
+	std::chrono::nanoseconds duration{0};
+	std::vector<TestOutcome> tests;		// In execution order
+	std::vector<SuiteResult> suites;	// Suites of the executed tests, parents before their children
+
+	bool IsSuccess() const
+	{
+		return (failedCount == 0);
+	}
+};
+
+// Runs a function on a background thread with a lowered priority, the destructor cancels an unfinished run and waits
+class AsyncTestRun
+{
+	CancellationToken m_cancellation;
+	TestRunResult m_result;
+	std::atomic<bool> m_finished;
+	std::thread m_thread;
+
+public:
+	AsyncTestRun(const CancellationToken& cancellation, std::function<TestRunResult()> run) : m_cancellation(cancellation), m_finished(false)
+	{
+		m_thread = std::thread([this, run]()
+		{
+			LowerCurrentThreadPriority();
+
+			m_result = run();
+			m_finished.store(true, std::memory_order_release);
+		});
+	}
+
+	~AsyncTestRun()
+	{
+		if (!IsFinished())
+			Cancel();	// The token is shared with the options of the caller, a finished run leaves it untouched
+
+		Wait();
+	}
+
+	AsyncTestRun(const AsyncTestRun&) = delete;
+	AsyncTestRun& operator=(const AsyncTestRun&) = delete;
+
+	// The running test is not interrupted, the following ones are skipped
+	void Cancel()
+	{
+		m_cancellation.Cancel();
+	}
+
+	bool IsFinished() const
+	{
+		return m_finished.load(std::memory_order_acquire);
+	}
+
+	const TestRunResult& Wait()
+	{
+		if (m_thread.joinable())
+			m_thread.join();
+
+		return m_result;
+	}
+
+	static void LowerCurrentThreadPriority()
+	{
+#ifdef __linux__
+		setpriority(PRIO_PROCESS, 0, 10);	// Only applies to the calling thread on Linux
+#elif defined(_WIN32)
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#endif
+	}
+};
+
+struct LoadOptions
+{
+	int threads = 1;
+	std::chrono::milliseconds duration = std::chrono::seconds(10);
+	double targetRate = 0.0;	// Invocations per second over all the threads in open loop, 0 to run in closed loop
+};
+
+struct StressOptions
+{
+	int repetitions = 100;
+	int threads = 1;		// Each test runs at once on this many threads, released together
+	bool shuffle = false;	// Randomize the order of the tests at each repetition
+	uint32_t seed = 0;		// Seed of the first repetition, incremented at each repetition. 0 for a random one
+	CancellationToken cancellation;
+	int maxFailures = 0;	// Stops after this many failed executions, 0 for no limit
+};
+
+struct WorkerPoolOptions
+{
+	int workers = 0;		// Worker processes, 0 for one per hardware thread
+	std::chrono::milliseconds testTimeout = std::chrono::seconds(60);	// The worker running a test for longer is killed
+};
+
+enum class ForkGranularity
+{
+	TEST,	// A process per test
+	GROUP	// A process per category, its tests run one after the other in it
+};
+
+struct ForkOptions
+{
+	ForkGranularity granularity = ForkGranularity::TEST;
+	int parallelism = 1;	// Child processes running at once
+	std::chrono::milliseconds testTimeout = std::chrono::seconds(60);
+};
+
+struct CanaryOptions
+{
+	std::chrono::milliseconds period = std::chrono::minutes(5);	// Between the starts of two runs
+	double maxCpuShare = 0.05;		// Fraction of one core, the scheduler sleeps after each test to stay below it
+	size_t historySize = 100;		// Executions of each test kept for the rolling stats
+};
+
+class UnitTestsManager
+{
+	struct TestExec
+	{
+		std::mutex mutex;	// CHECK can also be called from the threads started by a test
+		std::vector<std::string> errorMsgs;
+		bool isRecording = false;						// Record the checks for the determinism checker
+		uint64_t observationsHash = 14695981039346656037ull;
+		std::vector<std::string> observations;
+
+		void AddError(const std::string& errorMsg)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			errorMsgs.push_back(errorMsg);
+		}
+
+		// Rolling FNV-1a hash of the checks, in order
+		void AddObservation(bool passed, const std::string& observation)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			observations.push_back((passed ? "passed " : "failed ") + observation);
+
+			for (const char character : observations.back())
+			{
+				observationsHash = (observationsHash ^ static_cast<uint8_t>(character)) * 1099511628211ull;
+			}
+
+			observationsHash = (observationsHash ^ 0xFF) * 1099511628211ull;
+		}
+
+		void Reset()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			errorMsgs.clear();
+			observations.clear();
+			observationsHash = 14695981039346656037ull;
+		}
+	};
+	
+	std::vector<UnitTest> m_registeredUnitTests;
+	bool m_areTestsSorted = false;	// Cleared by RegisterTest
+	std::vector<Benchmark> m_registeredBenchmarks;
+	std::vector<BenchmarkComparison> m_registeredComparisons;
+	TestExec m_currentTest;	// Used by the serial runs and by the threads not running a test on their own
+	std::unique_ptr<LatencyHistogram> m_latencyHistogram;
+	std::atomic<bool> m_failFastTriggered{false};
+	std::atomic<const CancellationToken*> m_runCancellation{nullptr};	// Token of the current run, polled by IsCancellationRequested
+	std::atomic<int64_t> m_runDeadline{0};								// End of the time budget of the current run in steady clock nanoseconds, 0 for none
+	std::atomic<std::atomic<uint32_t>*> m_sharedCancellation{nullptr};	// Set by the parent of the child processes running the tests
+	std::recursive_mutex m_runMutex;	// Serializes the runs, they sort the tests and share the state above. Recursive for the in-process fallbacks
+
+	// Tree of the suites parsed from the "Category:Name" test names. Once sorted, the tests of a suite are contiguous
+	struct SuiteNode
+	{
+		std::string fullName;
+		int depth = 0;
+		size_t firstTest = 0;	// Range in the sorted tests
+		size_t endTest = 0;
+		std::map<std::string, size_t> children;	// Indexes in m_suites
+	};
+
+	std::vector<SuiteNode> m_suites = std::vector<SuiteNode>(1);	// The root is the first one
+
+	struct TestEvent
+	{
+		const UnitTest* test = nullptr;
+		bool success = false;
+		std::vector<std::string> errorMsgs;
+		std::string exceptionError;
+		std::vector<std::string> capturedOutput;
+		std::string latencySummary;
+	};
+
+	struct ReportState
+	{
+		int toExecuteCount = 0;
+		int executedCount = 0;
+		int errorsCount = 0;
+		std::chrono::steady_clock::time_point startTime;
+		std::chrono::steady_clock::time_point lastProgressTime;
+		size_t progressLength = 0;
+	};
+
+	struct StressStats
+	{
+		int runs = 0;
+		int passes = 0;
+		int firstFailedRepetition = -1;
+		uint32_t firstFailedSeed = 0;
+		std::vector<std::string> firstErrors;
+	};
+
+	struct LoadStats
+	{
+		std::atomic<uint64_t> runs{ 0 };
+		std::atomic<uint64_t> errors{ 0 };
+		LatencyHistogram latency;
+		std::mutex mutex;
+		std::vector<std::string> firstErrors;
+	};
+
+	enum class TestResult
+	{
+		DEFAULT,
+		SUCCESS,
+		FAILURE
+	};
+
+	// Buffers the result lines and sends them in batches with a single write. Colors them when the output is a terminal, unless NO_COLOR is set
+	class OutputWriter
+	{
+		std::ostream& m_output;
+		const bool m_isConsole;
+		bool m_ansiColors = false;
+		std::string m_buffer;
+		std::chrono::steady_clock::time_point m_lastFlush;
+
+	public:
+		explicit OutputWriter(std::ostream& output)
+			: m_output(output)
+			, m_isConsole(output.rdbuf() == std::cout.rdbuf())
+			, m_lastFlush(std::chrono::steady_clock::now())
+		{
+			const char* noColor = getenv("NO_COLOR");
+
+			if (m_isConsole && (noColor == nullptr || noColor[0] == '\0'))
+			{
+#ifdef _WIN32
+				DWORD mode = 0;
+				const HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+				m_ansiColors = (_isatty(_fileno(stdout)) && GetConsoleMode(console, &mode) && SetConsoleMode(console, mode | 0x0004));	// ENABLE_VIRTUAL_TERMINAL_PROCESSING, Windows 10 and above
+#else
+				m_ansiColors = (isatty(STDOUT_FILENO) != 0);
+#endif
+			}
+		}
+
+		OutputWriter(OutputWriter const&) = delete;
+		void operator=(OutputWriter const&) = delete;
+
+		~OutputWriter()
+		{
+			Flush();
+		}
+
+		void Write(const std::string& msg, TestResult result = TestResult::DEFAULT)
+		{
+#ifdef _WIN32
+			if (m_isConsole && !m_ansiColors)
+			{
+				WriteWithConsoleAttributes(msg, result);
+				return;
+			}
+#endif
+
+			if (m_ansiColors && result != TestResult::DEFAULT)
+			{
+				m_buffer += (result == TestResult::SUCCESS) ? "\x1b[92m" : "\x1b[91m";
+				m_buffer += msg;
+				m_buffer += "\x1b[0m\n";
+			}
+			else
+			{
+				m_buffer += msg;
+				m_buffer += '\n';
+			}
+
+			// Slow producers still show their results promptly
+			if (m_buffer.size() >= 64 * 1024 || std::chrono::steady_clock::now() - m_lastFlush >= std::chrono::milliseconds(100))
+			{
+				Flush();
+			}
+		}
+
+		bool IsConsole() const
+		{
+			return m_isConsole;
+		}
+
+		void WriteRaw(const std::string& text)
+		{
+			m_buffer += text;
+		}
+
+		// Before running a test on the console, so that its output comes after the previous results and a crash does not lose them
+		void FlushPending()
+		{
+			if (!m_buffer.empty())
+				Flush();
+		}
+
+		void Flush()
+		{
+			if (!m_buffer.empty())
+			{
+				m_output.write(m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+				m_buffer.clear();
+			}
+
+			m_output.flush();
+			m_lastFlush = std::chrono::steady_clock::now();
+		}
+
+	private:
+#ifdef _WIN32
+		void WriteWithConsoleAttributes(const std::string& msg, TestResult result)
+		{
+			Flush();
+
+			switch (result)
+			{
+			case TestResult::SUCCESS:
+				SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_GREEN | FOREGROUND_INTENSITY);
+				break;
+			case TestResult::FAILURE:
+				SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), FOREGROUND_RED | FOREGROUND_INTENSITY);
+				break;
+			default:
+				break;
+			}
+
+			m_output << msg << '\n';
+			m_output.flush();
+
+			SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 7);	// Reset to default color
+		}
+#endif
+	};
+	
+public:
+	UnitTestsManager() = default;
+	UnitTestsManager(UnitTestsManager const&) = delete;
+	void operator=(UnitTestsManager const&) = delete;
+
+	TestRunResult RunTests(std::ostream& output, const std::string& testsPath = "", const RunOptions& options = RunOptions())
+	{
+		std::lock_guard<std::recursive_mutex> runLock(m_runMutex);
+		SortTests();
+
+		return RunSelectedTests(output, SelectTests(testsPath, options.skipSuites), options);
+	}
+
+	// Runs the tests on a background thread with a lowered priority, for instance as a startup self-test.
+	// The output stream must outlive the returned run
+	std::unique_ptr<AsyncTestRun> RunTestsAsync(std::ostream& output, const std::string& testsPath = "", const RunOptions& options = RunOptions())
+	{
+		return std::unique_ptr<AsyncTestRun>(new AsyncTestRun(options.cancellation, [this, &output, testsPath, options]()
+		{
+			return RunTests(output, testsPath, options);
+		}));
+	}
+
+	// Runs the tests in a pool of long-lived worker processes pulling them from a shared memory queue, the crash of a test does not stop the run.
+	// A worker that crashes or times out is replaced. Output capture, asynchronous reporting and the journal are not supported in this mode
+	TestRunResult RunInWorkers(std::ostream& output, const std::string& testsPath = "", const WorkerPoolOptions& poolOptions = WorkerPoolOptions(), const RunOptions& options = RunOptions())
+	{
+		std::lock_guard<std::recursive_mutex> runLock(m_runMutex);
+		SortTests();
+
+		const std::vector<const UnitTest*> toExecute = SelectTests(testsPath, options.skipSuites);
+		const int workersCount = (poolOptions.workers > 0) ? poolOptions.workers : static_cast<int>(std::thread::hardware_concurrency());
+
+		std::vector<std::pair<uint32_t, uint32_t>> units;
+		for (uint32_t i = 0; i < toExecute.size(); ++i)
+		{
+			units.emplace_back(i, i + 1);
+		}
+
+		return RunInProcesses(output, testsPath, toExecute, units, workersCount, poolOptions.testTimeout, false, options);
+	}
+
+	// Forks a copy-on-write child per test or per group from the current state of the process, so that every test starts from the
+	// same initialized state without paying for the initialization again. Same limitations as RunInWorkers
+	TestRunResult RunForked(std::ostream& output, const std::string& testsPath = "", const ForkOptions& forkOptions = ForkOptions(), const RunOptions& options = RunOptions())
+	{
+		std::lock_guard<std::recursive_mutex> runLock(m_runMutex);
+		SortTests();
+
+		const std::vector<const UnitTest*> toExecute = SelectTests(testsPath, options.skipSuites);
+		std::vector<std::pair<uint32_t, uint32_t>> units;
+
+		for (uint32_t i = 0; i < toExecute.size(); ++i)
+		{
+			if (forkOptions.granularity == ForkGranularity::GROUP && !units.empty() && GetGroupName(*toExecute[i - 1]) == GetGroupName(*toExecute[i]))
+				units.back().second = i + 1;
+			else
+				units.emplace_back(i, i + 1);
+		}
+
+		return RunInProcesses(output, testsPath, toExecute, units, forkOptions.parallelism, forkOptions.testTimeout, true, options);
+	}
+
+	// For a test passing alone but failing after the tests before it, searches a minimal set of earlier tests making it fail.
+	// Each candidate set runs in a forked process, with a binary search over the prefixes of the earlier tests for each polluter.
+	// A process running for longer than runTimeout is killed, and the target counts as failed
+	std::vector<std::string> BisectPolluters(std::ostream& output, const std::string& targetTestName, const std::string& testsPath = "",
+		std::chrono::milliseconds runTimeout = std::chrono::seconds(60))
+	{
+		std::lock_guard<std::recursive_mutex> runLock(m_runMutex);
+		RunStateScope runState(*this, nullptr, std::chrono::nanoseconds(0));
+		OutputWriter writer(output);
+		std::vector<std::string> polluterNames;
+
+#ifdef _WIN32
+		(void)targetTestName;
+		(void)testsPath;
+		(void)runTimeout;
+		writer.Write("WARNING: Bisection requires child processes, which are not supported on Windows", TestResult::FAILURE);
+#else
+		SortTests();
+
+		const std::vector<const UnitTest*> selected = SelectTests(testsPath);
+		const auto target = std::find_if(selected.begin(), selected.end(), [&targetTestName](const UnitTest* test) { return test->GetFullName() == targetTestName; });
+
+		if (target == selected.end())
+		{
+			writer.Write("TEST " + targetTestName + " not found", TestResult::FAILURE);
+			return polluterNames;
+		}
+
+		std::vector<const UnitTest*> candidates(selected.begin(), target);
+		std::vector<const UnitTest*> polluters;
+		int runsCount = 0;
+
+		const auto fails = [this, &target, &runsCount, runTimeout](const std::vector<const UnitTest*>& before)
+		{
+			++runsCount;
+			return !RunAfterInChild(before, **target, runTimeout);
+		};
+
+		writer.Write("BISECTING " + targetTestName + " OVER THE " + std::to_string(candidates.size()) + " TESTS BEFORE IT...");
+		writer.Flush();
+
+		if (fails(polluters))
+		{
+			writer.Write("TEST " + targetTestName + " fails when run alone, it does not depend on the order", TestResult::FAILURE);
+			return polluterNames;
+		}
+
+		if (!fails(candidates))
+		{
+			writer.Write("TEST " + targetTestName + " passes after the tests before it, no polluter to find", TestResult::SUCCESS);
+			return polluterNames;
+		}
+
+		// Invariant: the target passes after the polluters found, and fails after all the candidates followed by them
+		while (!candidates.empty())
+		{
+			size_t low = 0;
+			size_t high = candidates.size();
+
+			while (low < high)
+			{
+				const size_t middle = low + (high - low) / 2;
+
+				std::vector<const UnitTest*> before(candidates.begin(), candidates.begin() + middle);
+				before.insert(before.end(), polluters.begin(), polluters.end());
+
+				if (fails(before))
+					high = middle;
+				else
+					low = middle + 1;
+			}
+
+			// The shortest failing prefix ends with a polluter
+			polluters.insert(polluters.begin(), candidates[low - 1]);
+			candidates.resize(low - 1);
+
+			writer.Write("\t Found " + polluters.front()->GetFullName() + " after " + std::to_string(runsCount) + " runs");
+			writer.Flush();
+
+			if (fails(polluters))
+				break;
+		}
+
+		std::string list;
+		for (const UnitTest* polluter : polluters)
+		{
+			polluterNames.push_back(polluter->GetFullName());
+			list += (list.empty() ? "" : ", ") + polluter->GetFullName();
+		}
+
+		writer.Write("POLLUTERS OF " + targetTestName + ": " + list + " (" + std::to_string(runsCount) + " runs)", TestResult::FAILURE);
+#endif
+
+		return polluterNames;
+	}
+
+	// Runs each test twice, in two processes forked from the same state on POSIX, and compares the sequences of their checks.
+	// CHECK only receives the result of its expression: the observations are the code, the outcome and the CHECK_PRINT message.
+	// A run lasting longer than testTimeout is killed, and the test is reported with the non-deterministic ones
+	std::vector<std::string> CheckDeterminism(std::ostream& output, const std::string& testsPath = "", std::chrono::milliseconds testTimeout = std::chrono::seconds(60))
+	{
+		std::lock_guard<std::recursive_mutex> runLock(m_runMutex);
+		RunStateScope runState(*this, nullptr, std::chrono::nanoseconds(0));
+		OutputWriter writer(output);
+
+		SortTests();
+
+		const std::vector<const UnitTest*> toExecute = SelectTests(testsPath);
+		std::vector<std::string> nonDeterministic;
+
+		writer.Write("CHECKING THE DETERMINISM OF " + std::to_string(toExecute.size()) + " UNIT TESTS...");
+		writer.Flush();
+
+		for (const UnitTest* test : toExecute)
+		{
+			const Observations first = RecordObservations(*test, testTimeout);
+			const Observations second = RecordObservations(*test, testTimeout);
+
+			if (first.isTimedOut || second.isTimedOut)
+			{
+				writer.Write("TEST " + test->GetFullName() + " -> Timed out after " + std::to_string(testTimeout.count()) + " ms, its determinism is unknown", TestResult::FAILURE);
+				nonDeterministic.push_back(test->GetFullName());
+				continue;
+			}
+
+			if (first.hash == second.hash)
+			{
+				writer.Write("TEST " + test->GetFullName() + " -> deterministic (" + std::to_string(first.lines.size()) + " observations)", TestResult::SUCCESS);
+				continue;
+			}
+
+			size_t difference = 0;
+			while (difference < first.lines.size() && difference < second.lines.size() && first.lines[difference] == second.lines[difference])
+			{
+				++difference;
+			}
+
+			const auto lineAt = [](const Observations& observations, size_t index) { return (index < observations.lines.size()) ? observations.lines[index] : std::string("<none>"); };
+
+			writer.Write("TEST " + test->GetFullName() + " -> NON-DETERMINISTIC", TestResult::FAILURE);
+			writer.Write("\t First difference at observation " + std::to_string(difference + 1) + ":", TestResult::FAILURE);
+			writer.Write("\t run 1: " + lineAt(first, difference), TestResult::FAILURE);
+			writer.Write("\t run 2: " + lineAt(second, difference), TestResult::FAILURE);
+
+			nonDeterministic.push_back(test->GetFullName());
+		}
+
+		const TestResult finalResult = nonDeterministic.empty() ? TestResult::SUCCESS : TestResult::FAILURE;
+		writer.Write("CHECKED " + std::to_string(toExecute.size()) + " UNIT TESTS. " + std::to_string(toExecute.size() - nonDeterministic.size()) + " deterministic, " + std::to_string(nonDeterministic.size()) + " non-deterministic", finalResult);
+
+		return nonDeterministic;
+	}
+
+	// Repeat the selected tests in-process to shake out the flaky and racy ones
+	void RunStress(std::ostream& output, const std::string& testsPath, const StressOptions& options)
+	{
+		std::lock_guard<std::recursive_mutex> runLock(m_runMutex);
+		OutputWriter writer(output);
+
+		SortTests();
+
+		const std::vector<const UnitTest*> selected = SelectTests(testsPath);
+		const int threadsCount = (std::max)(options.threads, 1);
+		const uint32_t baseSeed = (options.seed != 0) ? options.seed : std::random_device{}();
+
+		std::map<const UnitTest*, StressStats> stats;
+		int failuresCount = 0;
+		int stoppedRepetition = -1;
+
+		RunStateScope runState(*this, &options.cancellation, std::chrono::nanoseconds(0));
+
+		writer.Write("EXECUTING " + std::to_string(selected.size()) + " UNIT TESTS " + std::to_string(options.repetitions) + " TIMES ON " + std::to_string(threadsCount) + " THREADS (seed " + std::to_string(baseSeed) + ")...");
+		writer.Flush();
+
+		for (int repetition = 0; repetition < options.repetitions && stoppedRepetition < 0; ++repetition)
+		{
+			const uint32_t seed = baseSeed + static_cast<uint32_t>(repetition);
+			std::vector<const UnitTest*> toExecute = selected;	// Shuffled from the sorted order, so that the seed alone reproduces the repetition
+
+			if (options.shuffle)
+			{
+				std::mt19937 random(seed);
+				std::shuffle(toExecute.begin(), toExecute.end(), random);
+			}
+
+			for (const UnitTest* test : toExecute)
+			{
+				if (IsCancellationRequested())
+				{
+					stoppedRepetition = repetition;
+					break;
+				}
+
+				std::vector<TestExec> testExecs(threadsCount);
+				std::vector<std::string> exceptionErrors(threadsCount);
+				std::vector<char> results(threadsCount, 0);
+
+				if (threadsCount == 1)
+				{
+					results[0] = RunOnThread(*test, testExecs[0], exceptionErrors[0]);
+				}
+				else
+				{
+					SpinBarrier startBarrier(threadsCount);
+					std::vector<std::thread> threads;
+
+					for (int threadIndex = 0; threadIndex < threadsCount; ++threadIndex)
+					{
+						threads.emplace_back([this, test, &testExecs, &exceptionErrors, &results, &startBarrier, threadIndex]()
+						{
+							startBarrier.Wait();
+							results[threadIndex] = RunOnThread(*test, testExecs[threadIndex], exceptionErrors[threadIndex]);
+						});
+					}
+
+					for (std::thread& thread : threads)
+					{
+						thread.join();
+					}
+				}
+
+				StressStats& testStats = stats[test];
+
+				for (int threadIndex = 0; threadIndex < threadsCount; ++threadIndex)
+				{
+					++testStats.runs;
+
+					if (results[threadIndex] && testExecs[threadIndex].errorMsgs.empty())
+					{
+						++testStats.passes;
+						continue;
+					}
+
+					if (options.maxFailures > 0 && ++failuresCount >= options.maxFailures)
+						m_failFastTriggered.store(true, std::memory_order_relaxed);
+
+					if (testStats.firstFailedRepetition < 0)
+					{
+						testStats.firstFailedRepetition = repetition;
+						testStats.firstFailedSeed = seed;
+						testStats.firstErrors = testExecs[threadIndex].errorMsgs;
+
+						if (!exceptionErrors[threadIndex].empty())
+							testStats.firstErrors.push_back("Exception triggered: " + exceptionErrors[threadIndex]);
+					}
+				}
+			}
+		}
+
+		if (stoppedRepetition >= 0)
+			writer.Write("STOPPED at repetition " + std::to_string(stoppedRepetition) + " of " + std::to_string(options.repetitions), TestResult::FAILURE);
+
+		int flakyCount = 0;
+
+		for (const UnitTest* test : selected)
+		{
+			const StressStats& testStats = stats[test];
+			const std::string passRate = std::to_string(testStats.passes) + "/" + std::to_string(testStats.runs) + " passed (" + FormatDouble(testStats.runs > 0 ? 100.0 * testStats.passes / testStats.runs : 100.0) + "%)";
+
+			if (testStats.passes == testStats.runs)
+			{
+				writer.Write("TEST " + test->GetFullName() + " -> " + passRate, TestResult::SUCCESS);
+				continue;
+			}
+
+			writer.Write("TEST " + test->GetFullName() + " -> " + passRate, TestResult::FAILURE);
+			writer.Write("\t First failure at repetition " + std::to_string(testStats.firstFailedRepetition) + " (seed " + std::to_string(testStats.firstFailedSeed) + ")", TestResult::FAILURE);
+
+			for (const std::string& errorMsg : testStats.firstErrors)
+			{
+				writer.Write("\t " + errorMsg, TestResult::FAILURE);
+			}
+
+			++flakyCount;
+		}
+
+		const TestResult finalResult = (flakyCount == 0) ? TestResult::SUCCESS : TestResult::FAILURE;
+		writer.Write("EXECUTED " + std::to_string(selected.size()) + " UNIT TESTS " + std::to_string(options.repetitions) + " TIMES. " + std::to_string(selected.size() - flakyCount) + " always successful, " + std::to_string(flakyCount) + " failed at least once", finalResult);
+	}
+
+	// Use the selected tests as load generators: each thread invokes them in turn until the duration is over
+	void RunLoad(std::ostream& output, const std::string& testsPath, const LoadOptions& options)
+	{
+		std::lock_guard<std::recursive_mutex> runLock(m_runMutex);
+		RunStateScope runState(*this, nullptr, std::chrono::nanoseconds(0));
+		OutputWriter writer(output);
+
+		SortTests();
+
+		const std::vector<const UnitTest*> toExecute = SelectTests(testsPath);
+		const int threadsCount = (std::max)(options.threads, 1);
+
+		if (!m_latencyHistogram)
+		{
+			m_latencyHistogram.reset(new LatencyHistogram());
+		}
+
+		std::string mode = "closed loop";
+		if (options.targetRate > 0.0)
+			mode = "open loop at " + FormatDouble(options.targetRate) + " runs/s";
+
+		writer.Write("EXECUTING LOAD ON " + std::to_string(toExecute.size()) + " UNIT TESTS (" + std::to_string(threadsCount) + " threads, " + std::to_string(options.duration.count()) + " ms, " + mode + ")...");
+		writer.Flush();
+
+		if (toExecute.empty())
+		{
+			writer.Write("EXECUTED LOAD. 0 runs", TestResult::SUCCESS);
+			return;
+		}
+
+		std::vector<std::unique_ptr<LoadStats>> stats;
+		for (size_t i = 0; i < toExecute.size(); ++i)
+		{
+			stats.emplace_back(new LoadStats());
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		const auto end = start + options.duration;
+		std::vector<std::thread> threads;
+
+		for (int threadIndex = 0; threadIndex < threadsCount; ++threadIndex)
+		{
+			threads.emplace_back([this, &toExecute, &stats, &options, threadIndex, threadsCount, start, end]()
+			{
+				TestExec testExec;
+				GetThreadTest() = &testExec;
+
+				// In open loop, invocations are scheduled at a fixed interval and their latency is measured from the scheduled time, so that a stall also counts for the invocations it delayed (coordinated omission)
+				const bool openLoop = (options.targetRate > 0.0);
+				const std::chrono::nanoseconds interval = openLoop ? std::chrono::nanoseconds((std::max)(static_cast<int64_t>(1e9 * threadsCount / options.targetRate), static_cast<int64_t>(1))) : std::chrono::nanoseconds(0);	// At least 1 ns, the schedule would never reach the end otherwise
+				auto intendedStart = start + interval * threadIndex / threadsCount;
+				size_t testIndex = static_cast<size_t>(threadIndex) % toExecute.size();
+
+				while (true)
+				{
+					auto invocationStart = std::chrono::steady_clock::now();
+
+					if (openLoop)
+					{
+						// The invocations still late at the end are dropped, a rate the tests cannot sustain would never end otherwise
+						if (intendedStart >= end || invocationStart >= end)
+							break;
+
+						// Sleep until shortly before the scheduled time and spin for the rest, since the sleep overshoot would count as latency
+						if (intendedStart - invocationStart > std::chrono::microseconds(200))
+						{
+							std::this_thread::sleep_until(intendedStart - std::chrono::microseconds(100));
+						}
+
+						while (std::chrono::steady_clock::now() < intendedStart)
+						{
+						}
+
+						invocationStart = intendedStart;
+						intendedStart += interval;
+					}
+					else if (invocationStart >= end)
+					{
+						break;
+					}
+
+					std::string exceptionError;
+					testExec.Reset();
+
+					const bool testResult = toExecute[testIndex]->Run(exceptionError);
+					const auto invocationEnd = std::chrono::steady_clock::now();
+
+					LoadStats& testStats = *stats[testIndex];
+					testStats.runs.fetch_add(1, std::memory_order_relaxed);
+					testStats.latency.Record(invocationEnd - invocationStart);
+
+					if (!testResult || !testExec.errorMsgs.empty())
+					{
+						if (testStats.errors.fetch_add(1, std::memory_order_relaxed) == 0)
+						{
+							std::lock_guard<std::mutex> lock(testStats.mutex);
+							testStats.firstErrors = testExec.errorMsgs;
+
+							if (!exceptionError.empty())
+								testStats.firstErrors.push_back("Exception triggered: " + exceptionError);
+						}
+					}
+
+					testIndex = (testIndex + 1) % toExecute.size();
+				}
+
+				GetThreadTest() = nullptr;
+			});
+		}
+
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		const double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		uint64_t totalRuns = 0;
+		uint64_t totalErrors = 0;
+
+		for (size_t i = 0; i < toExecute.size(); ++i)
+		{
+			const LoadStats& testStats = *stats[i];
+			const uint64_t runs = testStats.runs.load();
+			const uint64_t errors = testStats.errors.load();
+			const TestResult result = (errors == 0) ? TestResult::SUCCESS : TestResult::FAILURE;
+
+			writer.Write("TEST " + toExecute[i]->GetFullName() + " -> " + std::to_string(runs) + " runs, " + FormatDouble(runs / elapsedSeconds) + " runs/s, " + std::to_string(errors) + " errors", result);
+			writer.Write("\t Latency: " + testStats.latency.GetSummary(), result);
+
+			for (const std::string& errorMsg : testStats.firstErrors)
+			{
+				writer.Write("\t First error: " + errorMsg, TestResult::FAILURE);
+			}
+
+			totalRuns += runs;
+			totalErrors += errors;
+		}
+
+		const TestResult finalResult = (totalErrors == 0) ? TestResult::SUCCESS : TestResult::FAILURE;
+		writer.Write("EXECUTED LOAD. " + std::to_string(totalRuns) + " runs, " + FormatDouble(totalRuns / elapsedSeconds) + " runs/s, " + std::to_string(totalErrors) + " errors", finalResult);
+	}
+	
+	void RunBenchmarks(std::ostream& output, const std::string& benchmarksPath = "")
+	{
+		std::lock_guard<std::recursive_mutex> runLock(m_runMutex);
+		RunStateScope runState(*this, nullptr, std::chrono::nanoseconds(0));
+		OutputWriter writer(output);
+
+		int successCount = 0;
+		int errorsCount = 0;
+
+		std::sort(m_registeredBenchmarks.begin(), m_registeredBenchmarks.end(), [](Benchmark& left, Benchmark& right)
+		{
+			return (left.GetFullName() < right.GetFullName());
+		});
+
+		std::sort(m_registeredComparisons.begin(), m_registeredComparisons.end(), [](BenchmarkComparison& left, BenchmarkComparison& right)
+		{
+			return (left.GetFullName() < right.GetFullName());
+		});
+
+		std::vector<const Benchmark*> toExecute;
+		for (const Benchmark& benchmark : m_registeredBenchmarks)
+		{
+			if (IsInPath(benchmark.GetFullName(), benchmarksPath))
+			{
+				toExecute.push_back(&benchmark);
+			}
+		}
+
+		std::vector<const BenchmarkComparison*> comparisonsToExecute;
+		for (const BenchmarkComparison& comparison : m_registeredComparisons)
+		{
+			if (IsInPath(comparison.GetFullName(), benchmarksPath))
+			{
+				comparisonsToExecute.push_back(&comparison);
+			}
+		}
+
+		const size_t toExecuteCount = toExecute.size() + comparisonsToExecute.size();
+
+		writer.Write("EXECUTING " + std::to_string(toExecuteCount) + " BENCHMARKS...");
+		writer.Write("Timer: " + BenchmarkClock::GetInstance().GetDescription());
+		writer.Flush();
+
+		BenchmarkEnvironment& environment = BenchmarkEnvironment::GetInstance();
+		std::vector<std::string> warnings = environment.GetWarnings();
+		const std::vector<std::string> applyWarnings = environment.Apply();
+		warnings.insert(warnings.end(), applyWarnings.begin(), applyWarnings.end());
+
+		for (const std::string& warning : warnings)
+		{
+			writer.Write("WARNING: " + warning, TestResult::FAILURE);
+		}
+
+		for (const Benchmark* benchmark : toExecute)
+		{
+			const BenchmarkOptions& options = benchmark->GetOptions();
+			const std::vector<int64_t> args = options.args.empty() ? std::vector<int64_t>{ 0 } : options.args;
+
+			const std::vector<int> threadCounts = options.threadCounts.empty() ? std::vector<int>{ 1 } : options.threadCounts;
+
+			std::vector<Benchmark::Measure> measures;
+			std::string exceptionError;
+			bool benchmarkResult = true;
+
+			for (int64_t arg : args)
+			{
+				double singleThreadOpsPerSecond = 0.0;
+
+				for (int threads : threadCounts)
+				{
+					m_currentTest.Reset();
+					Benchmark::Measure measure;
+					std::string name = options.args.empty() ? benchmark->GetFullName() : benchmark->GetFullName() + "/" + std::to_string(arg);
+
+					if (!options.threadCounts.empty())
+						name += "/threads:" + std::to_string(threads);
+
+					if (benchmark->Run(arg, threads, measure, exceptionError) && m_currentTest.errorMsgs.empty())
+					{
+						std::string msg = "BENCHMARK " + name + " -> " + FormatDouble(measure.nsPerOp) + " ns/op";
+
+						if (threads == 1)
+						{
+							singleThreadOpsPerSecond = measure.opsPerSecond;
+							measures.push_back(measure);
+						}
+
+						if (options.coldCache)
+						{
+							Benchmark::Measure coldMeasure;
+
+							// Cold runs use a fixed number of repetitions since the eviction dominates the run time
+							if (!benchmark->Run(arg, threads, coldMeasure, exceptionError, options.coldRepetitions * options.coldBatchSize, true))
+							{
+								writer.Write("BENCHMARK " + name + " (cold cache) -> FAILURE", TestResult::FAILURE);
+
+								if (!exceptionError.empty())
+								{
+									writer.Write("\t Exception triggered: " + exceptionError, TestResult::FAILURE);
+								}
+
+								benchmarkResult = false;
+								break;
+							}
+
+							msg += " warm, " + FormatDouble(coldMeasure.nsPerOp) + " ns/op cold (x" + FormatDouble(coldMeasure.nsPerOp / measure.nsPerOp) + ")";
+						}
+
+						if (!options.threadCounts.empty())
+						{
+							const double efficiency = measure.opsPerSecond / (singleThreadOpsPerSecond * threads);
+							msg += ", " + FormatDouble(measure.opsPerSecond / 1e6) + " Mop/s, efficiency " + FormatDouble(efficiency * 100.0) + "%";
+						}
+
+						if (measure.bytesPerSecond > 0.0)
+							msg += ", " + FormatDouble(measure.bytesPerSecond / 1e9) + " GB/s";
+
+						if (measure.itemsPerSecond > 0.0)
+							msg += ", " + FormatDouble(measure.itemsPerSecond / 1e6) + " Mitems/s";
+
+						for (const auto& counter : measure.counters)
+						{
+							msg += ", " + counter.first + "=" + FormatDouble(counter.second.first) + ((counter.second.second == CounterKind::RATE_PER_SECOND) ? "/s" : "");
+						}
+
+						writer.Write(msg + " (" + std::to_string(measure.iterations) + " iterations)", TestResult::SUCCESS);
+					}
+					else
+					{
+						writer.Write("BENCHMARK " + name + " -> FAILURE", TestResult::FAILURE);
+
+						for (const std::string& errorMsg : m_currentTest.errorMsgs)
+						{
+							writer.Write("\t " + errorMsg, TestResult::FAILURE);
+						}
+
+						if (!exceptionError.empty())
+						{
+							writer.Write("\t Exception triggered: " + exceptionError, TestResult::FAILURE);
+						}
+
+						benchmarkResult = false;
+						break;
+					}
+				}
+
+				if (!benchmarkResult)
+					break;
+			}
+
+			if (benchmarkResult && measures.size() >= 2)
+			{
+				const Benchmark::ComplexityFit fit = Benchmark::FitComplexity(measures);
+				const std::string fitMsg = "BENCHMARK " + benchmark->GetFullName() + " -> " + Benchmark::ComplexityToString(fit.complexity) + ", coefficient " + FormatDouble(fit.coefficient) + " ns, RMS " + FormatDouble(fit.rms * 100.0) + "%";
+
+				if (options.expectedComplexity != Complexity::UNSPECIFIED && fit.complexity > options.expectedComplexity)
+				{
+					writer.Write(fitMsg + " -> FAILURE", TestResult::FAILURE);
+					writer.Write("\t Complexity worse than the expected " + Benchmark::ComplexityToString(options.expectedComplexity), TestResult::FAILURE);
+					benchmarkResult = false;
+				}
+				else
+				{
+					writer.Write(fitMsg, TestResult::SUCCESS);
+				}
+			}
+
+			if (benchmarkResult)
+				++successCount;
+			else
+				++errorsCount;
+		}
+
+		for (const BenchmarkComparison* comparison : comparisonsToExecute)
+		{
+			const BenchmarkOptions& options = comparison->GetOptions();
+			const std::vector<int64_t> args = options.args.empty() ? std::vector<int64_t>{ 0 } : options.args;
+			bool comparisonResult = true;
+
+			for (int64_t arg : args)
+			{
+				m_currentTest.Reset();
+				BenchmarkComparison::Result result;
+				std::string exceptionError;
+				const std::string name = options.args.empty() ? comparison->GetFullName() : comparison->GetFullName() + "/" + std::to_string(arg);
+
+				if (comparison->Run(arg, result, exceptionError) && m_currentTest.errorMsgs.empty())
+				{
+					writer.Write("BENCHMARK_COMPARE " + name + " -> baseline " + FormatDouble(result.baselineNsPerOp) + " ns/op, candidate " + FormatDouble(result.candidateNsPerOp) + " ns/op, speedup x" + FormatDouble(result.speedup)
+						+ " (95% CI x" + FormatDouble(result.speedupLow) + " - x" + FormatDouble(result.speedupHigh) + ", " + std::to_string(result.blocks) + " blocks)", TestResult::SUCCESS);
+				}
+				else
+				{
+					writer.Write("BENCHMARK_COMPARE " + name + " -> FAILURE", TestResult::FAILURE);
+
+					for (const std::string& errorMsg : m_currentTest.errorMsgs)
+					{
+						writer.Write("\t " + errorMsg, TestResult::FAILURE);
+					}
+
+					if (!exceptionError.empty())
+					{
+						writer.Write("\t Exception triggered: " + exceptionError, TestResult::FAILURE);
+					}
+
+					comparisonResult = false;
+					break;
+				}
+			}
+
+			if (comparisonResult)
+				++successCount;
+			else
+				++errorsCount;
+		}
+
+		environment.Restore();
+
+		const TestResult finalResult = (errorsCount == 0) ? TestResult::SUCCESS : TestResult::FAILURE;
+		writer.Write("EXECUTED " + std::to_string(toExecuteCount) + " BENCHMARKS. " + std::to_string(successCount) + " successful, " + std::to_string(errorsCount) + " failed", finalResult);
+	}
+	
+	// Pin the benchmarks on the given CPUs, ideally isolated ones, and raise their scheduling priority while they run
+	void SetBenchmarkCpus(const std::vector<int>& cpus, bool raisePriority = true)
+	{
+		BenchmarkEnvironment::GetInstance().SetCpus(cpus, raisePriority);
+	}
+
+	void RegisterTest(const UnitTest& test)
+	{
+		m_registeredUnitTests.push_back(test);
+		m_areTestsSorted = false;
+
+		const std::string fullName = test.GetFullName();
+		size_t suite = 0;
+		size_t separator = fullName.find(':');
+
+		while (separator != std::string::npos)
+		{
+			const size_t componentStart = m_suites[suite].fullName.empty() ? 0 : m_suites[suite].fullName.size() + 1;
+			const std::string component = fullName.substr(componentStart, separator - componentStart);
+			const auto child = m_suites[suite].children.find(component);
+
+			if (child != m_suites[suite].children.end())
+			{
+				suite = child->second;
+			}
+			else
+			{
+				SuiteNode node;
+				node.fullName = fullName.substr(0, separator);
+				node.depth = m_suites[suite].depth + 1;
+
+				m_suites[suite].children[component] = m_suites.size();
+				suite = m_suites.size();
+				m_suites.push_back(std::move(node));
+			}
+
+			separator = fullName.find(':', separator + 1);
+		}
+	}
+
+	void RegisterBenchmark(const Benchmark& benchmark)
+	{
+		m_registeredBenchmarks.push_back(benchmark);
+	}
+
+	void RegisterBenchmark(const BenchmarkComparison& comparison)
+	{
+		m_registeredComparisons.push_back(comparison);
+	}
+
+	static UnitTestsManager& GetInstance()
+	{
+		static UnitTestsManager testsManager;
+		return testsManager;
+	}
+
+	void Check(bool exp, const std::string& code)
+	{
+		TestExec& currentTest = GetCurrentTest();
+
+		if (currentTest.isRecording)
+			currentTest.AddObservation(exp, "CHECK " + code);
+
+		if (!exp)
+		{
+			currentTest.AddError("CHECK failed on: " + code);
+		}
+	}
+	
+	void Check(bool exp, const std::string& code, const std::string& debugPrint)
+	{
+		TestExec& currentTest = GetCurrentTest();
+
+		if (currentTest.isRecording)
+			currentTest.AddObservation(exp, "CHECK " + code + "  -  " + debugPrint);
+
+		if (!exp)
+		{
+			currentTest.AddError("CHECK failed on: " + code + "  -  " + debugPrint);
+		}
+	}
+	
+	// Cheap enough to be polled by long or multi-threaded tests, true once the current run is cancelled, fail-fast triggered or its time budget expired.
+	// Also signalled to the tests running in the child processes of RunInWorkers and RunForked
+	bool IsCancellationRequested() const
+	{
+		if (m_failFastTriggered.load(std::memory_order_relaxed))
+			return true;
+
+		const std::atomic<uint32_t>* sharedCancellation = m_sharedCancellation.load(std::memory_order_acquire);
+		if (sharedCancellation && sharedCancellation->load(std::memory_order_relaxed) != 0)
+			return true;
+
+		const int64_t deadline = m_runDeadline.load(std::memory_order_relaxed);
+		if (deadline != 0 && std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() >= deadline)
+			return true;
+
+		const CancellationToken* cancellation = m_runCancellation.load(std::memory_order_acquire);
+		return (cancellation && cancellation->IsCancelled());
+	}
+
+	// Thread-safe, the percentiles are reported with the result of the test
+	void RecordLatency(std::chrono::nanoseconds duration)
+	{
+		if (m_latencyHistogram)
+		{
+			m_latencyHistogram->Record(duration);
+		}
+	}
+
+	void Require(bool exp, const std::string& code)
+	{
+		TestExec& currentTest = GetCurrentTest();
+
+		if (currentTest.isRecording)
+			currentTest.AddObservation(exp, "REQUIRE " + code);
+
+		if (!exp)
+		{
+			currentTest.AddError("REQUIRE failed on: " + code);
+			
+			throw APFailException();
+		}
+	}
+	
+	void Require(bool exp, const std::string& code, const std::string& debugPrint)
+	{
+		TestExec& currentTest = GetCurrentTest();
+
+		if (currentTest.isRecording)
+			currentTest.AddObservation(exp, "REQUIRE " + code + "  -  " + debugPrint);
+
+		if (!exp)
+		{
+			currentTest.AddError("REQUIRE failed on: " + code + "  -  " + debugPrint);
+
+			throw APFailException();
+		}
+	}
+
+private:
+	friend class CanaryScheduler;
+
+	std::vector<std::string> SelectTestNames(const std::string& testsPath)
+	{
+		std::lock_guard<std::recursive_mutex> runLock(m_runMutex);
+		SortTests();
+
+		std::vector<std::string> testNames;
+		for (const UnitTest* test : SelectTests(testsPath))
+		{
+			testNames.push_back(test->GetFullName());
+		}
+
+		return testNames;
+	}
+
+	// Runs only the test with this full name, not the tests of the suite with the same name
+	TestRunResult RunTestNamed(std::ostream& output, const std::string& fullName, const RunOptions& options)
+	{
+		std::lock_guard<std::recursive_mutex> runLock(m_runMutex);
+		SortTests();
+
+		std::vector<const UnitTest*> toExecute;
+		const size_t test = FindTest(fullName);
+
+		if (test != SIZE_MAX)
+			toExecute.push_back(&m_registeredUnitTests[test]);
+
+		return RunSelectedTests(output, toExecute, options);
+	}
+
+	// Callers hold m_runMutex and sorted the tests
+	TestRunResult RunSelectedTests(std::ostream& output, const std::vector<const UnitTest*>& toExecute, const RunOptions& options)
+	{
+		OutputWriter writer(output);
+
+		const auto toExecuteTestsCount = static_cast<int>(toExecute.size());
+		const bool isReporting = (options.outputMode != OutputMode::NONE);
+		const auto runStartTime = std::chrono::steady_clock::now();
+
+		TestRunResult runResult;
+		runResult.tests.reserve(toExecute.size());
+
+		RunStateScope runState(*this, &options.cancellation, options.timeBudget);
+
+		if (!m_latencyHistogram)
+		{
+			m_latencyHistogram.reset(new LatencyHistogram());
+		}
+
+		if (isReporting)
+		{
+			writer.Write("EXECUTING " + std::to_string(toExecuteTestsCount) + " UNIT TESTS...");
+			writer.Flush();
+		}
+
+		ReportState reportState;
+		reportState.toExecuteCount = toExecuteTestsCount;
+		reportState.startTime = std::chrono::steady_clock::now();
+		reportState.lastProgressTime = reportState.startTime;
+
+		std::unique_ptr<OutputCapture> outputCapture;
+		if (options.captureOutput)
+		{
+			outputCapture.reset(new OutputCapture(options.captureBufferSize));
+
+			if (!outputCapture->Start())
+			{
+				if (isReporting)
+					writer.Write("WARNING: Output capture is not supported on this platform", TestResult::FAILURE);
+
+				outputCapture.reset();
+			}
+		}
+
+		RunJournal journal;
+		std::map<std::string, RunJournal::Entry> journalTests;
+
+		if (!options.journalPath.empty() && !journal.Open(options.journalPath, options.resume, journalTests) && isReporting)
+			writer.Write("WARNING: Failed to open the run journal " + options.journalPath, TestResult::FAILURE);
+
+		// While a test runs its output is redirected, a reporter thread writing on the console at the same time would be captured
+		const bool asyncReporting = isReporting && options.asyncReporting && !(outputCapture && writer.IsConsole());
+		// The tests print on the same console. In verbose mode, this writes once per test: the batching only applies to the other outputs
+		const bool flushBeforeTests = writer.IsConsole() && !outputCapture && !asyncReporting;
+		std::unique_ptr<BoundedQueue<TestEvent>> reportQueue;
+		std::atomic<bool> reportDone(false);
+		std::thread reporter;
+
+		if (asyncReporting)
+		{
+			writer.Flush();
+			reportQueue.reset(new BoundedQueue<TestEvent>(options.reportQueueCapacity));
+
+			reporter = std::thread([&writer, &options, &reportState, &reportQueue, &reportDone]()
+			{
+				TestEvent event;
+
+				while (true)
+				{
+					if (reportQueue->TryPop(event))
+					{
+						ReportTest(writer, event, options, reportState);
+					}
+					else if (reportDone.load(std::memory_order_acquire))
+					{
+						while (reportQueue->TryPop(event))
+						{
+							ReportTest(writer, event, options, reportState);
+						}
+
+						break;
+					}
+					else
+					{
+						std::this_thread::sleep_for(std::chrono::microseconds(50));
+					}
+				}
+			});
+		}
+		
+		for (const UnitTest* test : toExecute)
+		{
+			if (IsCancellationRequested())
+			{
+				runResult.skippedCount = toExecuteTestsCount - runResult.executedCount;
+				break;
+			}
+
+			TestEvent event;
+			event.test = test;
+
+			TestOutcome outcome;
+			outcome.name = test->GetFullName();
+
+			const auto journalTest = journalTests.find(outcome.name);
+
+			if (journalTest != journalTests.end())
+			{
+				event.success = journalTest->second.success;
+				outcome.duration = journalTest->second.duration;
+
+				if (journalTest->second.crashed)
+					event.errorMsgs.push_back("Crashed in a previous run");
+				else if (!event.success)
+					event.errorMsgs.push_back("Failed in a previous run");
+
+				++runResult.resumedCount;
+			}
+			else
+			{
+				m_currentTest.Reset();
+
+				if (m_latencyHistogram->IsUsed())
+				{
+					m_latencyHistogram->Reset();
+				}
+
+				journal.RecordStart(outcome.name);
+
+				if (flushBeforeTests)
+					writer.FlushPending();
+
+				if (outputCapture)
+					outputCapture->BeginTest();
+
+				const auto testStartTime = std::chrono::steady_clock::now();
+				const bool testResult = test->Run(event.exceptionError);
+				outcome.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - testStartTime);
+
+				if (outputCapture)
+					event.capturedOutput = outputCapture->EndTest();
+
+				event.success = (testResult && m_currentTest.errorMsgs.empty());
+				event.errorMsgs = std::move(m_currentTest.errorMsgs);
+				journal.RecordEnd(outcome.name, event.success, outcome.duration);
+
+				if (m_latencyHistogram->IsUsed())
+					event.latencySummary = m_latencyHistogram->GetSummary();
+			}
+
+			AddOutcome(runResult, std::move(outcome), event, options);
+
+			if (!isReporting)
+			{
+				continue;
+			}
+			else if (asyncReporting)
+			{
+				while (!reportQueue->TryPush(event))
+				{
+					std::this_thread::yield();	// Backpressure, the reporter is late
+				}
+			}
+			else
+			{
+				ReportTest(writer, event, options, reportState);
+			}
+		}
+
+		if (asyncReporting)
+		{
+			reportDone.store(true, std::memory_order_release);
+			reporter.join();
+		}
+
+		runResult.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - runStartTime);
+
+		AggregateSuites(runResult);
+
+		if (isReporting)
+		{
+			ClearProgress(writer, reportState.progressLength);
+			ReportSuites(writer, runResult, options);
+
+			const TestResult finalResult = runResult.IsSuccess() ? TestResult::SUCCESS : TestResult::FAILURE;
+			const std::string skipped = (runResult.skippedCount > 0) ? ", " + std::to_string(runResult.skippedCount) + " skipped" : "";
+			writer.Write("EXECUTED " + std::to_string(runResult.executedCount) + " UNIT TESTS. " + std::to_string(runResult.successCount) + " successful, " + std::to_string(runResult.failedCount) + " failed" + skipped, finalResult);
+		}
+
+		return runResult;
+	}
+
+	// Sets the state polled by IsCancellationRequested for the duration of a run, every run starts without fail-fast, budget or token
+	class RunStateScope
+	{
+	public:
+		RunStateScope(UnitTestsManager& manager, const CancellationToken* cancellation, std::chrono::nanoseconds timeBudget) : m_manager(manager)
+		{
+			m_manager.BeginRunState(cancellation, timeBudget);
+		}
+
+		~RunStateScope()
+		{
+			m_manager.EndRunState();
+		}
+
+	private:
+		UnitTestsManager& m_manager;
+	};
+
+	void BeginRunState(const CancellationToken* cancellation, std::chrono::nanoseconds timeBudget)
+	{
+		int64_t deadline = 0;
+		if (timeBudget.count() > 0)
+			deadline = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch() + timeBudget).count();
+
+		m_failFastTriggered.store(false, std::memory_order_relaxed);
+		m_runDeadline.store(deadline, std::memory_order_relaxed);
+		m_runCancellation.store(cancellation, std::memory_order_release);
+	}
+
+	void EndRunState()
+	{
+		m_runCancellation.store(nullptr, std::memory_order_release);
+		m_runDeadline.store(0, std::memory_order_relaxed);
+		m_failFastTriggered.store(false, std::memory_order_relaxed);
+	}
+
+	static TestExec*& GetThreadTest()
+	{
+		thread_local TestExec* threadTest = nullptr;
+		return threadTest;
+	}
+
+	bool RunOnThread(const UnitTest& test, TestExec& testExec, std::string& exceptionError)
+	{
+		GetThreadTest() = &testExec;
+		const bool testResult = test.Run(exceptionError);
+		GetThreadTest() = nullptr;
+
+		return testResult;
+	}
+
+	TestExec& GetCurrentTest()
+	{
+		TestExec* threadTest = GetThreadTest();
+		return threadTest ? *threadTest : m_currentTest;
+	}
+
+	// The tests must be sorted. A suite path and the skipped suites are taken as ranges of the sorted tests, along with the test named
+	// like the suite if any. It sorts before the range but not always right before it, "A-B" sorts between "A" and "A:B"
+	std::vector<const UnitTest*> SelectTests(const std::string& testsPath, const std::vector<std::string>& skipSuites = std::vector<std::string>()) const
+	{
+		std::vector<const UnitTest*> selected;
+
+		const SuiteNode* pathSuite = FindSuite(testsPath);
+		const size_t begin = pathSuite ? pathSuite->firstTest : 0;
+		const size_t end = pathSuite ? pathSuite->endTest : m_registeredUnitTests.size();
+
+		std::vector<std::pair<size_t, size_t>> skippedRanges;
+		for (const std::string& skipSuite : skipSuites)
+		{
+			if (const SuiteNode* suite = FindSuite(skipSuite))
+				skippedRanges.emplace_back(suite->firstTest, suite->endTest);
+
+			const size_t skippedTest = FindTest(skipSuite);
+			if (skippedTest != SIZE_MAX)
+				skippedRanges.emplace_back(skippedTest, skippedTest + 1);
+		}
+
+		const auto getSkippedEnd = [&skippedRanges](size_t i)
+		{
+			size_t skippedEnd = i;
+			for (const auto& range : skippedRanges)
+			{
+				if (range.first <= i && i < range.second)
+					skippedEnd = (std::max)(skippedEnd, range.second);
+			}
+
+			return skippedEnd;
+		};
+
+		if (pathSuite)
+		{
+			const size_t pathTest = FindTest(testsPath);
+			if (pathTest != SIZE_MAX && getSkippedEnd(pathTest) == pathTest)
+				selected.push_back(&m_registeredUnitTests[pathTest]);
+		}
+
+		for (size_t i = begin; i < end;)
+		{
+			const size_t skippedEnd = getSkippedEnd(i);
+
+			if (skippedEnd > i)
+			{
+				i = skippedEnd;
+				continue;
+			}
+
+			if (pathSuite || IsInPath(m_registeredUnitTests[i].GetFullName(), testsPath))
+				selected.push_back(&m_registeredUnitTests[i]);
+
+			++i;
+		}
+
+		return selected;
+	}
+
+	// Index of the test with this full name in the sorted tests, SIZE_MAX for none
+	size_t FindTest(const std::string& fullName) const
+	{
+		const auto test = std::lower_bound(m_registeredUnitTests.begin(), m_registeredUnitTests.end(), fullName, [](const UnitTest& left, const std::string& name) { return left.GetFullName() < name; });
+
+		if (test == m_registeredUnitTests.end() || test->GetFullName() != fullName)
+			return SIZE_MAX;
+
+		return static_cast<size_t>(test - m_registeredUnitTests.begin());
+	}
+
+	const SuiteNode* FindSuite(const std::string& suiteName) const
+	{
+		if (suiteName.empty() || suiteName.back() == '*' || suiteName.back() == ':')
+			return nullptr;
+
+		size_t suite = 0;
+		size_t componentStart = 0;
+
+		while (componentStart <= suiteName.size())
+		{
+			const size_t separator = (std::min)(suiteName.find(':', componentStart), suiteName.size());
+			const auto child = m_suites[suite].children.find(suiteName.substr(componentStart, separator - componentStart));
+
+			if (child == m_suites[suite].children.end())
+				return nullptr;
+
+			suite = child->second;
+			componentStart = separator + 1;
+		}
+
+		return &m_suites[suite];
+	}
+
+	// Sums the outcomes of the tests in their suites and their parents
+	void AggregateSuites(TestRunResult& runResult) const
+	{
+		std::vector<SuiteResult> suiteResults(m_suites.size());
+
+		for (const TestOutcome& outcome : runResult.tests)
+		{
+			size_t suite = 0;
+			size_t componentStart = 0;
+			size_t separator = outcome.name.find(':');
+
+			while (separator != std::string::npos)
+			{
+				const auto child = m_suites[suite].children.find(outcome.name.substr(componentStart, separator - componentStart));
+				if (child == m_suites[suite].children.end())
+					break;
+
+				suite = child->second;
+
+				SuiteResult& suiteResult = suiteResults[suite];
+				++suiteResult.executedCount;
+				++(outcome.success ? suiteResult.successCount : suiteResult.failedCount);
+				suiteResult.duration += outcome.duration;
+
+				componentStart = separator + 1;
+				separator = outcome.name.find(':', componentStart);
+			}
+		}
+
+		// Depth-first, in the order of the names
+		std::vector<size_t> toVisit;
+		for (auto child = m_suites[0].children.rbegin(); child != m_suites[0].children.rend(); ++child)
+		{
+			toVisit.push_back(child->second);
+		}
+
+		while (!toVisit.empty())
+		{
+			const size_t suite = toVisit.back();
+			toVisit.pop_back();
+
+			if (suiteResults[suite].executedCount == 0)
+				continue;
+
+			SuiteResult& suiteResult = suiteResults[suite];
+			suiteResult.name = m_suites[suite].fullName;
+			suiteResult.depth = m_suites[suite].depth;
+			runResult.suites.push_back(std::move(suiteResult));
+
+			for (auto child = m_suites[suite].children.rbegin(); child != m_suites[suite].children.rend(); ++child)
+			{
+				toVisit.push_back(child->second);
+			}
+		}
+	}
+
+	static void ReportSuites(OutputWriter& writer, const TestRunResult& runResult, const RunOptions& options)
+	{
+		for (const SuiteResult& suite : runResult.suites)
+		{
+			if (suite.depth > options.suiteSummaryDepth)
+				continue;
+
+			const TestResult result = (suite.failedCount == 0) ? TestResult::SUCCESS : TestResult::FAILURE;
+			writer.Write(std::string(suite.depth - 1, '\t') + "SUITE " + suite.name + ": " + std::to_string(suite.executedCount) + " tests, " + std::to_string(suite.successCount) + " successful, "
+				+ std::to_string(suite.failedCount) + " failed in " + LatencyHistogram::FormatDuration(suite.duration.count()), result);
+		}
+	}
+
+	static bool IsInPath(const std::string& fullName, const std::string& path)
+	{
+		if (path.empty())
+			return true;
+
+		if (path.back() == '*')
+			return (fullName.compare(0, path.size() - 1, path, 0, path.size() - 1) == 0);
+
+		if (fullName.compare(0, path.size(), path) != 0)
+			return false;
+
+		return (fullName.size() == path.size() || fullName[path.size()] == ':' || path.back() == ':');
+	}
+
+	void AddOutcome(TestRunResult& runResult, TestOutcome outcome, const TestEvent& event, const RunOptions& options)
+	{
+		outcome.success = event.success;
+
+		if (event.success)
+		{
+			++runResult.successCount;
+		}
+		else
+		{
+			++runResult.failedCount;
+			outcome.failures = event.errorMsgs;
+
+			if (options.maxFailures > 0 && runResult.failedCount >= options.maxFailures)
+				m_failFastTriggered.store(true, std::memory_order_relaxed);
+
+			if (!event.exceptionError.empty())
+				outcome.failures.push_back("Exception triggered: " + event.exceptionError);
+		}
+
+		++runResult.executedCount;
+		runResult.tests.push_back(std::move(outcome));
+
+		if (options.onTestDone)
+			options.onTestDone(runResult.tests.back());
+	}
+
+#ifndef _WIN32
+	// Runs the units (ranges of tests) in forked processes. With processPerUnit each process runs a single unit and exits,
+	// otherwise the processes are long-lived workers pulling the units until there are none left
+	TestRunResult RunInProcesses(std::ostream& output, const std::string& testsPath, const std::vector<const UnitTest*>& toExecute, const std::vector<std::pair<uint32_t, uint32_t>>& units,
+		int processesCount, std::chrono::milliseconds testTimeout, bool processPerUnit, const RunOptions& options)
+	{
+		OutputWriter writer(output);
+
+		const uint32_t testsCount = static_cast<uint32_t>(toExecute.size());
+		const uint32_t unitsCount = static_cast<uint32_t>(units.size());
+		const bool isReporting = (options.outputMode != OutputMode::NONE);
+		const int slotsCount = (std::max)(1, (std::min)(processesCount, static_cast<int>((std::max)(unitsCount, 1u))));
+		const auto runStartTime = std::chrono::steady_clock::now();
+
+		TestRunResult runResult;
+		runResult.tests.reserve(toExecute.size());
+
+		RunStateScope runState(*this, &options.cancellation, options.timeBudget);
+
+		ReportState reportState;
+		reportState.toExecuteCount = static_cast<int>(testsCount);
+		reportState.startTime = runStartTime;
+		reportState.lastProgressTime = runStartTime;
+
+		if (isReporting)
+		{
+			const std::string processes = processPerUnit ? " IN " + std::to_string(unitsCount) + " FORKED PROCESSES (" + std::to_string(slotsCount) + " AT ONCE)..." : " ON " + std::to_string(slotsCount) + " WORKER PROCESSES...";
+			writer.Write("EXECUTING " + std::to_string(testsCount) + " UNIT TESTS" + processes);
+		}
+
+		writer.Flush();
+		fflush(nullptr);	// The buffered output would be written again by each child
+
+		SharedResult* results = MapShared<SharedResult>(testsCount);
+		WorkerSlot* slots = MapShared<WorkerSlot>(slotsCount);
+		std::atomic<uint32_t>* nextUnit = MapShared<std::atomic<uint32_t>>(2);	// Followed by the cancellation flag polled in the children
+
+		if (!results || !slots || !nextUnit)
+		{
+			UnmapShared(results, testsCount);
+			UnmapShared(slots, slotsCount);
+			UnmapShared(nextUnit, 2);
+
+			writer.Write("WARNING: Failed to map the memory shared with the child processes, the tests run in-process", TestResult::FAILURE);
+			writer.Flush();
+			return RunTests(output, testsPath, options);
+		}
+
+		std::vector<uint32_t> unitEnds(testsCount);
+		for (const auto& unit : units)
+		{
+			std::fill(unitEnds.begin() + unit.first, unitEnds.begin() + unit.second, unit.second);
+		}
+
+		std::vector<pid_t> processes(slotsCount, -1);
+		std::vector<char> timedOut(slotsCount, 0);
+		std::string forkError;
+		m_sharedCancellation.store(&nextUnit[1], std::memory_order_release);
+
+		const auto startProcess = [&](int slotIndex)
+		{
+			slots[slotIndex].currentTest.store(-1, std::memory_order_relaxed);
+			timedOut[slotIndex] = 0;
+
+			const pid_t pid = fork();
+			if (pid == 0)
+			{
+				RunUnits(toExecute, units, results, slots[slotIndex], *nextUnit, processPerUnit);
+				fflush(nullptr);
+				_exit(0);
+			}
+
+			if (pid < 0 && forkError.empty())
+			{
+				forkError = strerror(errno);
+				writer.Write("ERROR: Failed to start a child process: " + forkError, TestResult::FAILURE);
+			}
+
+			processes[slotIndex] = pid;
+		};
+
+		for (int slotIndex = 0; slotIndex < slotsCount; ++slotIndex)
+		{
+			startProcess(slotIndex);
+		}
+
+		uint32_t nextToReport = 0;
+
+		while (nextToReport < testsCount)
+		{
+			const auto now = std::chrono::steady_clock::now();
+			bool isProcessAlive = false;
+
+			if (IsCancellationRequested())
+			{
+				nextUnit[0].store(unitsCount, std::memory_order_relaxed);
+				nextUnit[1].store(1, std::memory_order_relaxed);
+			}
+
+			for (int slotIndex = 0; slotIndex < slotsCount; ++slotIndex)
+			{
+				if (processes[slotIndex] <= 0)
+					continue;
+
+				WorkerSlot& slot = slots[slotIndex];
+				int status = 0;
+
+				if (waitpid(processes[slotIndex], &status, WNOHANG) == processes[slotIndex])
+				{
+					// Read once reaped, the process can no longer move to another test
+					const int32_t currentTest = slot.currentTest.load(std::memory_order_acquire);
+					processes[slotIndex] = -1;
+
+					// The test the process was running when it died is reported with the cause, the following tests of its unit were not run
+					if (currentTest >= 0 && results[currentTest].state.load(std::memory_order_acquire) != static_cast<uint32_t>(SharedState::DONE))
+					{
+						const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(now - StartTimeToTimePoint(slot.startTime.load(std::memory_order_relaxed)));
+						const std::string cause = timedOut[slotIndex] ? "Timed out after " + std::to_string(testTimeout.count()) + " ms" : DescribeTermination(status);
+
+						WriteSharedResult(results[currentTest], false, duration, { cause });
+
+						for (uint32_t i = currentTest + 1; i < unitEnds[currentTest]; ++i)
+						{
+							WriteSharedResult(results[i], false, std::chrono::nanoseconds(0), { "Not run, the process died in " + toExecute[currentTest]->GetFullName() });
+						}
+					}
+
+					if (nextUnit->load(std::memory_order_relaxed) < unitsCount)
+						startProcess(slotIndex);
+				}
+				else if (slot.currentTest.load(std::memory_order_acquire) >= 0 && !timedOut[slotIndex] && now - StartTimeToTimePoint(slot.startTime.load(std::memory_order_relaxed)) > testTimeout)
+				{
+					kill(processes[slotIndex], SIGKILL);
+					timedOut[slotIndex] = 1;
+				}
+
+				if (processes[slotIndex] > 0)
+					isProcessAlive = true;
+			}
+
+			// The results are reported in the order of the tests
+			while (nextToReport < testsCount && results[nextToReport].state.load(std::memory_order_acquire) == static_cast<uint32_t>(SharedState::DONE))
+			{
+				ReportSharedResult(toExecute[nextToReport], results[nextToReport], runResult, options, writer, reportState);
+				++nextToReport;
+			}
+
+			if (!isProcessAlive)
+			{
+				// Skipped when cancelled. Otherwise they were lost by a process dying between two tests, or no process could be started
+				const bool isCancelled = (nextUnit[1].load(std::memory_order_relaxed) != 0);
+				const std::string notRunCause = forkError.empty() ? "Not run, the process running it died" : "Not run, failed to start a child process: " + forkError;
+
+				for (; nextToReport < testsCount; ++nextToReport)
+				{
+					if (results[nextToReport].state.load(std::memory_order_acquire) != static_cast<uint32_t>(SharedState::DONE))
+					{
+						if (isCancelled)
+						{
+							++runResult.skippedCount;
+							continue;
+						}
+
+						WriteSharedResult(results[nextToReport], false, std::chrono::nanoseconds(0), { notRunCause });
+					}
+
+					ReportSharedResult(toExecute[nextToReport], results[nextToReport], runResult, options, writer, reportState);
+				}
+
+				break;
+			}
+
+			if (nextToReport < testsCount)
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+
+		for (pid_t process : processes)
+		{
+			if (process > 0)
+				waitpid(process, nullptr, 0);
+		}
+
+		m_sharedCancellation.store(nullptr, std::memory_order_release);
+		UnmapShared(results, testsCount);
+		UnmapShared(slots, slotsCount);
+		UnmapShared(nextUnit, 2);
+
+		runResult.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - runStartTime);
+
+		AggregateSuites(runResult);
+
+		if (isReporting)
+		{
+			ClearProgress(writer, reportState.progressLength);
+			ReportSuites(writer, runResult, options);
+
+			const TestResult finalResult = runResult.IsSuccess() ? TestResult::SUCCESS : TestResult::FAILURE;
+			const std::string skipped = (runResult.skippedCount > 0) ? ", " + std::to_string(runResult.skippedCount) + " skipped" : "";
+			writer.Write("EXECUTED " + std::to_string(runResult.executedCount) + " UNIT TESTS. " + std::to_string(runResult.successCount) + " successful, " + std::to_string(runResult.failedCount) + " failed" + skipped, finalResult);
+		}
+
+		return runResult;
+	}
+#else
+	TestRunResult RunInProcesses(std::ostream& output, const std::string& testsPath, const std::vector<const UnitTest*>&, const std::vector<std::pair<uint32_t, uint32_t>>&,
+		int, std::chrono::milliseconds, bool, const RunOptions& options)
+	{
+		output << "WARNING: Child processes are not supported on Windows, the tests run in-process" << std::endl;
+		return RunTests(output, testsPath, options);
+	}
+#endif
+
+	struct Observations
+	{
+		uint64_t hash = 0;
+		std::vector<std::string> lines;
+		bool isTimedOut = false;
+	};
+
+	// The observations of a test run, ending with its result. On POSIX the test runs in a forked child with its output discarded
+	Observations RecordObservations(const UnitTest& test, std::chrono::milliseconds timeout)
+	{
+		Observations observations;
+
+#ifdef _WIN32
+		(void)timeout;
+		m_currentTest.Reset();
+		m_currentTest.isRecording = true;
+
+		std::string exceptionError;
+		const bool testResult = test.Run(exceptionError);
+		m_currentTest.AddObservation(testResult, "END " + exceptionError);
+		m_currentTest.isRecording = false;
+
+		observations.hash = m_currentTest.observationsHash;
+		observations.lines = m_currentTest.observations;
+#else
+		SharedObservations* shared = MapShared<SharedObservations>(1);
+		if (!shared)
+			return observations;
+
+		fflush(nullptr);
+
+		const pid_t pid = fork();
+		if (pid == 0)
+		{
+			const int nullFile = open("/dev/null", O_WRONLY);
+			if (nullFile >= 0)
+			{
+				dup2(nullFile, STDOUT_FILENO);
+				dup2(nullFile, STDERR_FILENO);
+			}
+
+			m_currentTest.Reset();
+			m_currentTest.isRecording = true;
+
+			std::string exceptionError;
+			const bool testResult = test.Run(exceptionError);
+			m_currentTest.AddObservation(testResult, "END " + exceptionError);
+
+			std::string text;
+			for (const std::string& observation : m_currentTest.observations)
+			{
+				text += observation + "\n";
+			}
+
+			shared->hash = m_currentTest.observationsHash;
+			shared->textLength = static_cast<uint32_t>((std::min)(text.size(), sizeof(shared->text)));
+			memcpy(shared->text, text.data(), shared->textLength);
+			shared->state.store(static_cast<uint32_t>(SharedState::DONE), std::memory_order_release);
+			_exit(0);
+		}
+
+		int status = 0;
+		observations.isTimedOut = (pid > 0 && !WaitForChild(pid, status, timeout));
+
+		if (shared->state.load(std::memory_order_acquire) == static_cast<uint32_t>(SharedState::DONE))
+		{
+			observations.hash = shared->hash;
+
+			const std::string text(shared->text, shared->textLength);
+			size_t position = 0;
+
+			while (position < text.size())
+			{
+				const size_t end = (std::min)(text.find('\n', position), text.size());
+				observations.lines.push_back(text.substr(position, end - position));
+				position = end + 1;
+			}
+		}
+		else
+		{
+			const std::string cause = observations.isTimedOut ? "Timed out after " + std::to_string(timeout.count()) + " ms" : (pid > 0) ? DescribeTermination(status) : "Failed to fork";
+			observations.hash = std::hash<std::string>()(cause);
+			observations.lines.push_back(cause);
+		}
+
+		UnmapShared(shared, 1);
+#endif
+
+		return observations;
+	}
+
+	// Category of a test, without its last name component
+	static std::string GetGroupName(const UnitTest& test)
+	{
+		const std::string fullName = test.GetFullName();
+		const size_t separator = fullName.rfind(':');
+
+		return (separator == std::string::npos) ? std::string() : fullName.substr(0, separator);
+	}
+
+#ifndef _WIN32
+	enum class SharedState : uint32_t
+	{
+		PENDING,
+		DONE
+	};
+
+	// Result of a test written by a child process
+	struct SharedResult
+	{
+		std::atomic<uint32_t> state;
+		uint32_t success;
+		uint64_t nanoseconds;
+		uint32_t failuresLength;
+		char failures[1024];	// Failure messages separated by new lines, truncated
+	};
+
+	struct SharedObservations
+	{
+		std::atomic<uint32_t> state;
+		uint64_t hash;
+		uint32_t textLength;
+		char text[256 * 1024];	// Observations separated by new lines, truncated
+	};
+
+	struct WorkerSlot
+	{
+		std::atomic<int32_t> currentTest;	// -1 when idle
+		std::atomic<int64_t> startTime;		// Of the current test, in steady clock nanoseconds
+	};
+
+	// Anonymous mapping shared with the forked processes
+	template <typename T>
+	static T* MapShared(size_t count)
+	{
+		void* mapping = mmap(nullptr, (std::max)(count, static_cast<size_t>(1)) * sizeof(T), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (mapping == MAP_FAILED)
+			return nullptr;
+
+		T* objects = static_cast<T*>(mapping);
+		for (size_t i = 0; i < count; ++i)
+		{
+			new (&objects[i]) T();
+		}
+
+		return objects;
+	}
+
+	template <typename T>
+	static void UnmapShared(T* objects, size_t count)
+	{
+		if (objects)
+			munmap(objects, (std::max)(count, static_cast<size_t>(1)) * sizeof(T));
+	}
+
+	static std::chrono::steady_clock::time_point StartTimeToTimePoint(int64_t startTime)
+	{
+		return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(startTime)));
+	}
+
+	static void WriteSharedResult(SharedResult& result, bool success, std::chrono::nanoseconds duration, const std::vector<std::string>& failures)
+	{
+		std::string text;
+		for (const std::string& failure : failures)
+		{
+			text += failure + "\n";
+		}
+
+		result.success = success ? 1 : 0;
+		result.nanoseconds = static_cast<uint64_t>(duration.count());
+		result.failuresLength = static_cast<uint32_t>((std::min)(text.size(), sizeof(result.failures)));
+		memcpy(result.failures, text.data(), result.failuresLength);
+		result.state.store(static_cast<uint32_t>(SharedState::DONE), std::memory_order_release);
+	}
+
+	// Runs a test in the current (child) process and writes its result
+	void RunInChild(const UnitTest& test, SharedResult& result)
+	{
+		m_currentTest.Reset();
+
+		std::string exceptionError;
+		const auto startTime = std::chrono::steady_clock::now();
+		const bool testResult = test.Run(exceptionError);
+		const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime);
+
+		std::vector<std::string> failures = m_currentTest.errorMsgs;
+		if (!exceptionError.empty())
+			failures.push_back("Exception triggered: " + exceptionError);
+
+		fflush(nullptr);
+		WriteSharedResult(result, testResult && m_currentTest.errorMsgs.empty(), duration, failures);
+	}
+
+	void RunUnits(const std::vector<const UnitTest*>& toExecute, const std::vector<std::pair<uint32_t, uint32_t>>& units, SharedResult* results, WorkerSlot& slot, std::atomic<uint32_t>& nextUnit, bool singleUnit)
+	{
+		while (true)
+		{
+			const uint32_t unitIndex = nextUnit.fetch_add(1, std::memory_order_relaxed);
+			if (unitIndex >= units.size())
+				break;
+
+			for (uint32_t testIndex = units[unitIndex].first; testIndex < units[unitIndex].second; ++testIndex)
+			{
+				slot.startTime.store(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(), std::memory_order_relaxed);
+				slot.currentTest.store(static_cast<int32_t>(testIndex), std::memory_order_release);
+
+				RunInChild(*toExecute[testIndex], results[testIndex]);
+
+				slot.currentTest.store(-1, std::memory_order_release);
+			}
+
+			if (singleUnit)
+				break;
+		}
+	}
+
+	// Runs tests then the target in a forked child with its output discarded, returns whether the target passed
+	bool RunAfterInChild(const std::vector<const UnitTest*>& before, const UnitTest& target, std::chrono::milliseconds timeout)
+	{
+		SharedResult* result = MapShared<SharedResult>(1);
+		if (!result)
+			return false;
+
+		fflush(nullptr);
+
+		const pid_t pid = fork();
+		if (pid == 0)
+		{
+			const int nullFile = open("/dev/null", O_WRONLY);
+			if (nullFile >= 0)
+			{
+				dup2(nullFile, STDOUT_FILENO);
+				dup2(nullFile, STDERR_FILENO);
+			}
+
+			for (const UnitTest* test : before)
+			{
+				std::string exceptionError;
+				m_currentTest.Reset();
+				test->Run(exceptionError);
+			}
+
+			RunInChild(target, *result);
+			_exit(0);
+		}
+
+		int status = 0;
+		if (pid > 0)
+			WaitForChild(pid, status, timeout);
+
+		const bool passed = (result->state.load(std::memory_order_acquire) == static_cast<uint32_t>(SharedState::DONE) && result->success != 0);
+		UnmapShared(result, 1);
+
+		return passed;
+	}
+
+	void ReportSharedResult(const UnitTest* test, const SharedResult& result, TestRunResult& runResult, const RunOptions& options, OutputWriter& writer, ReportState& reportState)
+	{
+		TestEvent event;
+		event.test = test;
+		event.success = (result.success != 0);
+
+		const std::string failures(result.failures, result.failuresLength);
+		size_t position = 0;
+
+		while (position < failures.size())
+		{
+			const size_t end = (std::min)(failures.find('\n', position), failures.size());
+			event.errorMsgs.push_back(failures.substr(position, end - position));
+			position = end + 1;
+		}
+
+		TestOutcome outcome;
+		outcome.name = test->GetFullName();
+		outcome.duration = std::chrono::nanoseconds(result.nanoseconds);
+
+		AddOutcome(runResult, std::move(outcome), event, options);
+
+		if (options.outputMode != OutputMode::NONE)
+			ReportTest(writer, event, options, reportState);
+	}
+
+	static std::string DescribeTermination(int status)
+	{
+		if (WIFSIGNALED(status))
+			return "Crashed with signal " + std::to_string(WTERMSIG(status)) + " (" + strsignal(WTERMSIG(status)) + ")";
+
+		if (WIFEXITED(status))
+			return "Process exited with code " + std::to_string(WEXITSTATUS(status)) + " during the test";
+
+		return "Process terminated during the test";
+	}
+
+	// Reaps a child, killing it once the timeout expires. Returns false when it was killed
+	static bool WaitForChild(pid_t pid, int& status, std::chrono::milliseconds timeout)
+	{
+		const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+		while (waitpid(pid, &status, WNOHANG) == 0)
+		{
+			if (std::chrono::steady_clock::now() > deadline)
+			{
+				kill(pid, SIGKILL);
+				waitpid(pid, &status, 0);
+				return false;
+			}
+
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+
+		return true;
+	}
+#endif
+
+	static void ReportTest(OutputWriter& writer, const TestEvent& event, const RunOptions& options, ReportState& state)
+	{
+		++state.executedCount;
+
+		if (event.success)
+		{
+			if (options.outputMode == OutputMode::VERBOSE)
+			{
+				writer.Write("TEST " + event.test->GetFullName() + " -> SUCCESS", TestResult::SUCCESS);
+
+				if (!event.latencySummary.empty())
+				{
+					writer.Write("\t Latency: " + event.latencySummary, TestResult::SUCCESS);
+				}
+			}
+		}
+		else
+		{
+			++state.errorsCount;
+
+			ClearProgress(writer, state.progressLength);
+			writer.Write("TEST " + event.test->GetFullName() + " -> FAILURE", TestResult::FAILURE);
+
+			if (!event.latencySummary.empty())
+			{
+				writer.Write("\t Latency: " + event.latencySummary, TestResult::FAILURE);
+			}
+
+			for (const std::string& errorMsg : event.errorMsgs)
+			{
+				writer.Write("\t " + errorMsg, TestResult::FAILURE);
+			}
+
+			if (!event.exceptionError.empty())
+			{
+				writer.Write("\t Exception triggered: " + event.exceptionError, TestResult::FAILURE);
+			}
+
+			if (!event.capturedOutput.empty())
+			{
+				writer.Write("\t Captured output:", TestResult::FAILURE);
+
+				for (const std::string& line : event.capturedOutput)
+				{
+					writer.Write("\t | " + line, TestResult::DEFAULT);
+				}
+			}
+		}
+
+		if (options.outputMode == OutputMode::PROGRESS)
+		{
+			const auto now = std::chrono::steady_clock::now();
+
+			if (now - state.lastProgressTime >= std::chrono::milliseconds(100))
+			{
+				const double elapsedSeconds = std::chrono::duration<double>(now - state.startTime).count();
+				const std::string progress = "[" + std::to_string(state.executedCount) + "/" + std::to_string(state.toExecuteCount) + "] " + FormatDouble(state.executedCount / elapsedSeconds) + " tests/s, " + std::to_string(state.errorsCount) + " failed";
+
+				ClearProgress(writer, state.progressLength);
+				writer.WriteRaw(progress);
+				writer.Flush();
+				state.progressLength = progress.size();
+				state.lastProgressTime = now;
+			}
+		}
+	}
+
+	static void ClearProgress(OutputWriter& writer, size_t& progressLength)
+	{
+		if (progressLength > 0)
+		{
+			writer.WriteRaw('\r' + std::string(progressLength, ' ') + '\r');
+			progressLength = 0;
+		}
+	}
+
+	static std::string FormatDouble(double value)
+	{
+		char buffer[32];
+		const double magnitude = std::fabs(value);
+		snprintf(buffer, sizeof(buffer), (magnitude >= 100.0) ? "%.0f" : (magnitude >= 0.1 || magnitude == 0.0) ? "%.2f" : "%.3g", value);
+		return buffer;
+	}
+
+	
+	void SortTests()
+	{
+		if (m_areTestsSorted)
+			return;
+
+		std::sort(m_registeredUnitTests.begin(), m_registeredUnitTests.end(), [](UnitTest& left, UnitTest& right)
+		{
+			return (left.GetFullName() < right.GetFullName());
+		});
+
+		for (SuiteNode& suite : m_suites)
+		{
+			suite.firstTest = 0;
+			suite.endTest = 0;
+		}
+
+		for (size_t i = 0; i < m_registeredUnitTests.size(); ++i)
+		{
+			const std::string fullName = m_registeredUnitTests[i].GetFullName();
+			size_t suite = 0;
+			size_t componentStart = 0;
+			size_t separator = fullName.find(':');
+
+			while (separator != std::string::npos)
+			{
+				suite = m_suites[suite].children.at(fullName.substr(componentStart, separator - componentStart));
+
+				if (m_suites[suite].endTest == 0)
+					m_suites[suite].firstTest = i;
+
+				m_suites[suite].endTest = i + 1;
+
+				componentStart = separator + 1;
+				separator = fullName.find(':', componentStart);
+			}
+		}
+
+		m_areTestsSorted = true;
+	}
+};
+
+// Periodically runs a filtered set of tests inside a live process on an idle priority thread.
+// The runs of the manager are serialized and the canary runs one test at a time, another run waits for one canary test at most
+class CanaryScheduler
+{
+public:
+	struct TestStats
+	{
+		std::string name;
+		uint64_t totalRunsCount = 0;
+		uint64_t totalFailuresCount = 0;
+		size_t windowRunsCount = 0;			// Over the last historySize executions
+		size_t windowFailuresCount = 0;
+		uint64_t p50Nanoseconds = 0;
+		uint64_t p99Nanoseconds = 0;
+		uint64_t maxNanoseconds = 0;
+		std::vector<std::string> lastFailures;
+		std::chrono::system_clock::time_point lastFailureTime;
+	};
+
+	struct Stats
+	{
+		uint64_t runsCount = 0;
+		std::chrono::system_clock::time_point lastRunTime;
+		std::chrono::nanoseconds lastRunDuration{0};
+		std::chrono::nanoseconds cpuTime{0};	// Used by the tests since the start
+		std::vector<TestStats> tests;
+	};
+
+private:
+	struct Execution
+	{
+		bool success;
+		uint64_t nanoseconds;
+	};
+
+	struct TestHistory
+	{
+		std::vector<Execution> executions;	// Ring buffer of historySize entries
+		size_t nextExecution = 0;
+		uint64_t totalRunsCount = 0;
+		uint64_t totalFailuresCount = 0;
+		std::vector<std::string> lastFailures;
+		std::chrono::system_clock::time_point lastFailureTime;
+	};
+
+	UnitTestsManager& m_manager;
+	const std::string m_testsPath;
+	const CanaryOptions m_options;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_stopCondition;
+	bool m_stopping = false;
+	CancellationToken m_cancellation;
+	std::thread m_thread;
+
+	std::map<std::string, TestHistory> m_histories;
+	uint64_t m_runsCount = 0;
+	std::chrono::system_clock::time_point m_lastRunTime;
+	std::chrono::nanoseconds m_lastRunDuration{0};
+	std::chrono::nanoseconds m_cpuTime{0};
+
+public:
+	CanaryScheduler(UnitTestsManager& manager, const std::string& testsPath, const CanaryOptions& options = CanaryOptions()) : m_manager(manager), m_testsPath(testsPath), m_options(options)
+	{
+	}
+
+	~CanaryScheduler()
+	{
+		Stop();
+	}
+
+	CanaryScheduler(const CanaryScheduler&) = delete;
+	CanaryScheduler& operator=(const CanaryScheduler&) = delete;
+
+	void Start()
+	{
+		if (m_thread.joinable())
+			return;
+
+		m_stopping = false;
+		m_cancellation = CancellationToken();
+		m_thread = std::thread(&CanaryScheduler::Loop, this);
+	}
+
+	// The running test is not interrupted
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+
+		m_cancellation.Cancel();
+		m_stopCondition.notify_all();
+
+		if (m_thread.joinable())
+			m_thread.join();
+	}
+
+	// Can be called from any thread while the scheduler runs
+	Stats GetStats() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		Stats stats;
+		stats.runsCount = m_runsCount;
+		stats.lastRunTime = m_lastRunTime;
+		stats.lastRunDuration = m_lastRunDuration;
+		stats.cpuTime = m_cpuTime;
+
+		for (const auto& entry : m_histories)
+		{
+			const TestHistory& history = entry.second;
+
+			TestStats testStats;
+			testStats.name = entry.first;
+			testStats.totalRunsCount = history.totalRunsCount;
+			testStats.totalFailuresCount = history.totalFailuresCount;
+			testStats.windowRunsCount = history.executions.size();
+			testStats.lastFailures = history.lastFailures;
+			testStats.lastFailureTime = history.lastFailureTime;
+
+			std::vector<uint64_t> durations;
+			durations.reserve(history.executions.size());
+
+			for (const Execution& execution : history.executions)
+			{
+				durations.push_back(execution.nanoseconds);
+
+				if (!execution.success)
+					++testStats.windowFailuresCount;
+			}
+
+			if (!durations.empty())
+			{
+				std::sort(durations.begin(), durations.end());
+				testStats.p50Nanoseconds = durations[(durations.size() - 1) / 2];
+				testStats.p99Nanoseconds = durations[(durations.size() - 1) * 99 / 100];
+				testStats.maxNanoseconds = durations.back();
+			}
+
+			stats.tests.push_back(std::move(testStats));
+		}
+
+		return stats;
+	}
+
+	void WriteStats(std::ostream& output) const
+	{
+		const Stats stats = GetStats();
+
+		output << "CANARY " << m_testsPath << ": " << stats.runsCount << " runs, last one took " << LatencyHistogram::FormatDuration(stats.lastRunDuration.count())
+			<< ", " << LatencyHistogram::FormatDuration(stats.cpuTime.count()) << " of CPU time in total" << std::endl;
+
+		for (const TestStats& test : stats.tests)
+		{
+			output << "\t" << test.name << ": " << (test.windowRunsCount - test.windowFailuresCount) << "/" << test.windowRunsCount << " passed"
+				<< " (" << test.totalFailuresCount << " failures in " << test.totalRunsCount << " runs)"
+				<< " p50=" << LatencyHistogram::FormatDuration(test.p50Nanoseconds) << " p99=" << LatencyHistogram::FormatDuration(test.p99Nanoseconds)
+				<< " max=" << LatencyHistogram::FormatDuration(test.maxNanoseconds) << std::endl;
+
+			if (test.windowFailuresCount > 0)
+			{
+				for (const std::string& failure : test.lastFailures)
+				{
+					output << "\t\t" << failure << std::endl;
+				}
+			}
+		}
+	}
+
+private:
+	void Loop()
+	{
+		SetIdlePriority();
+
+		std::ostream nullOutput(nullptr);
+
+		RunOptions runOptions;
+		runOptions.outputMode = OutputMode::NONE;
+		runOptions.cancellation = m_cancellation;
+		runOptions.onTestDone = [this](const TestOutcome& outcome)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			RecordExecution(outcome);
+		};
+
+		while (true)
+		{
+			const auto runStartTime = std::chrono::steady_clock::now();
+			const std::vector<std::string> testNames = m_manager.SelectTestNames(m_testsPath);
+			bool isComplete = true;
+
+			// One test per run, so that the other runs of the manager wait for one test at most and never for the sleeps below
+			for (const std::string& testName : testNames)
+			{
+				const std::chrono::nanoseconds cpuMark = GetThreadCpuTime();
+				const TestRunResult result = m_manager.RunTestNamed(nullOutput, testName, runOptions);
+				const std::chrono::nanoseconds cpuUsed = GetThreadCpuTime() - cpuMark;
+
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cpuTime += cpuUsed;
+
+				if (result.skippedCount > 0 || m_stopping)
+				{
+					isComplete = false;
+					break;
+				}
+
+				// Duty cycle, the CPU time used is followed by a sleep keeping the average below maxCpuShare
+				if (m_options.maxCpuShare > 0.0 && m_options.maxCpuShare < 1.0)
+				{
+					const auto sleepTime = std::chrono::duration_cast<std::chrono::nanoseconds>(cpuUsed * (1.0 / m_options.maxCpuShare - 1.0));
+
+					if (m_stopCondition.wait_for(lock, sleepTime, [this]() { return m_stopping; }))
+					{
+						isComplete = false;
+						break;
+					}
+				}
+			}
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			if (isComplete)
+			{
+				++m_runsCount;
+				m_lastRunTime = std::chrono::system_clock::now();
+				m_lastRunDuration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - runStartTime);
+			}
+
+			if (m_stopCondition.wait_until(lock, runStartTime + m_options.period, [this]() { return m_stopping; }))
+				break;
+		}
+	}
+
+	void RecordExecution(const TestOutcome& outcome)
+	{
+		TestHistory& history = m_histories[outcome.name];
+		const Execution execution{ outcome.success, static_cast<uint64_t>(outcome.duration.count()) };
+
+		if (history.executions.size() < (std::max)(m_options.historySize, static_cast<size_t>(1)))
+		{
+			history.executions.push_back(execution);
+		}
+		else
+		{
+			history.executions[history.nextExecution] = execution;
+			history.nextExecution = (history.nextExecution + 1) % history.executions.size();
+		}
+
+		++history.totalRunsCount;
+
+		if (!outcome.success)
+		{
+			++history.totalFailuresCount;
+			history.lastFailures = outcome.failures;
+			history.lastFailureTime = std::chrono::system_clock::now();
+		}
+	}
+
+	static void SetIdlePriority()
+	{
+#ifdef __linux__
+		sched_param param;
+		param.sched_priority = 0;
+
+		if (sched_setscheduler(0, SCHED_IDLE, &param) != 0)	// Only applies to the calling thread on Linux
+			setpriority(PRIO_PROCESS, 0, 19);
+#elif defined(_WIN32)
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#endif
+	}
+
+	static std::chrono::nanoseconds GetThreadCpuTime()
+	{
+#ifdef _WIN32
+		FILETIME creationTime, exitTime, kernelTime, userTime;
+		if (!GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime))
+			return std::chrono::nanoseconds(0);
+
+		const uint64_t kernel = (static_cast<uint64_t>(kernelTime.dwHighDateTime) << 32) | kernelTime.dwLowDateTime;
+		const uint64_t user = (static_cast<uint64_t>(userTime.dwHighDateTime) << 32) | userTime.dwLowDateTime;
+		return std::chrono::nanoseconds((kernel + user) * 100);
+#else
+		timespec time;
+		if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0)
+			return std::chrono::nanoseconds(0);
+
+		return std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+#endif
+	}
+};
+
+class UnitTestAutoRegister
+{
+public:
+	UnitTestAutoRegister(const UnitTest& test)
+	{
+		UnitTestsManager::GetInstance().RegisterTest(test);
+	}
+};
+
+class BenchmarkAutoRegister
+{
+public:
+	BenchmarkAutoRegister(const Benchmark& benchmark)
+	{
+		UnitTestsManager::GetInstance().RegisterBenchmark(benchmark);
+	}
+
+	BenchmarkAutoRegister(const BenchmarkComparison& comparison)
+	{
+		UnitTestsManager::GetInstance().RegisterBenchmark(comparison);
+	}
+};
+
+#define AP_CONCAT_IMPL( x, y )		x##y
+#define AP_MACRO_CONCAT( x, y )	AP_CONCAT_IMPL( x, y )
+
+// Test macros
+#define UNIT_TEST(_name)			static UnitTestAutoRegister AP_MACRO_CONCAT(testRegister_, __COUNTER__)(UnitTest(_name, []() -> void
+#define UNIT_TEST_END				));
+#define CHECK(_exp)					UnitTestsManager::GetInstance().Check(_exp, #_exp);
+#define CHECK_PRINT(_exp, _deb)		UnitTestsManager::GetInstance().Check(_exp, #_exp, _deb);
+#define REQUIRE(_exp)				UnitTestsManager::GetInstance().Require(_exp, #_exp);
+#define REQUIRE_PRINT(_exp, _deb)	UnitTestsManager::GetInstance().Require(_exp, #_exp, _deb);
+#define RECORD_LATENCY(_duration)	UnitTestsManager::GetInstance().RecordLatency(_duration);
+#define TEST_CANCELLED()			UnitTestsManager::GetInstance().IsCancellationRequested()
+
+// Benchmark macros
+#define BENCHMARK(_name)						static BenchmarkAutoRegister AP_MACRO_CONCAT(benchmarkRegister_, __COUNTER__)(Benchmark(_name, BenchmarkOptions(), [](BenchmarkState& state) -> void
+#define BENCHMARK_WITH(_name, _options)		static BenchmarkAutoRegister AP_MACRO_CONCAT(benchmarkRegister_, __COUNTER__)(Benchmark(_name, _options, [](BenchmarkState& state) -> void
+#define BENCHMARK_END						));
+// The implementations are macro arguments, prefer named functions: a comma in the body of a lambda would split it
+#define BENCHMARK_COMPARE(_name, _baseline, _candidate)					static BenchmarkAutoRegister AP_MACRO_CONCAT(benchmarkRegister_, __COUNTER__)(BenchmarkComparison(_name, BenchmarkOptions(), _baseline, _candidate));
+#define BENCHMARK_COMPARE_WITH(_name, _options, _baseline, _candidate)	static BenchmarkAutoRegister AP_MACRO_CONCAT(benchmarkRegister_, __COUNTER__)(BenchmarkComparison(_name, _options, _baseline, _candidate));
\ No newline at end of file